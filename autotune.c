@@ -0,0 +1,309 @@
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "autotune.h"
+#include "util.h"
+
+// each candidate is timed this many times after a warm up and the fastest counts
+#define TUNE_REPEATS 3
+#define HOSTNAME_LENGTH 256
+#define PHASE_NAME_LENGTH 16
+#define NPHASES 4
+#define STEP_PHASE 0
+#define STENCIL_PHASE 1
+#define AGENTS_PHASE 2
+#define COLORIZE_PHASE 3
+
+// everything an iteration needs to run on the real problem size
+struct TuneContext {
+    // copies of the trail map and agents, so the simulation starts unchanged
+    struct Map trail_map;
+    struct Map food_map;
+    struct AgentPool pool;
+    // the agents every timed iteration starts from
+    struct Agent *agents;
+    int nagents;
+    int *agent_pos_freq;
+    unsigned int *seeds;
+    struct IterationSettings settings;
+    // filled in by every timed iteration if the run computes statistics, else NULL
+    struct StepStats *stats;
+    // a frame of either kind, so timing doesn't include the allocation
+    struct Color *frame;
+};
+
+// runs with the same key load the same profile
+struct ProfileKey {
+    char host[HOSTNAME_LENGTH];
+    int width;
+    int height;
+    int nagents;
+    int max_threads;
+    // color_image and index_image write frames of a different size
+    int indexed;
+    // the statistics change the evaporation and recording loops
+    int analytics;
+    // the agent loops only test for dead agents if the population changes
+    int dynamic;
+};
+
+struct ScheduleCandidate {
+    omp_sched_t schedule;
+    int chunk;
+};
+
+struct ScheduleCandidate schedule_candidates[] = {
+    {omp_sched_static, 0},
+    {omp_sched_static, 64},
+    {omp_sched_dynamic, 8},
+    {omp_sched_dynamic, 64},
+    {omp_sched_dynamic, 512},
+    {omp_sched_guided, 0},
+    {omp_sched_guided, 64},
+};
+
+int tile_candidates[] = {64, 256, 1024, 4096};
+
+// every phase runs in the iteration's parallel region, so they are timed as
+// whole iterations. The agents start alike every time, so the population
+// doesn't starve or grow while tuning, and are never compacted
+double time_iteration(struct TuneContext *ctx, struct Tuning tuning) {
+    memcpy(ctx->pool.agents, ctx->agents, ctx->nagents * sizeof(*ctx->agents));
+    ctx->pool.count = ctx->nagents;
+    memset(ctx->pool.spawn_counts, 0, ctx->pool.nthreads * sizeof(*ctx->pool.spawn_counts));
+    double start = omp_get_wtime();
+    simulate_iteration(&ctx->trail_map, ctx->food_map, &ctx->pool, ctx->agent_pos_freq, ctx->seeds, ctx->settings, 0, ctx->frame, tuning, ctx->stats);
+    return omp_get_wtime() - start;
+}
+
+double measure(struct TuneContext *ctx, struct Tuning tuning) {
+    time_iteration(ctx, tuning);
+    double best = time_iteration(ctx, tuning);
+    for (int i = 1; i < TUNE_REPEATS; i++) {
+        double elapsed = time_iteration(ctx, tuning);
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+// keeps the candidate if it is faster than the best so far
+void try_candidate(struct TuneContext *ctx, struct Tuning candidate, struct Tuning *best, double *best_time) {
+    double elapsed = measure(ctx, candidate);
+    if (elapsed < *best_time) {
+        *best = candidate;
+        *best_time = elapsed;
+    }
+}
+
+const char *phase_names[] = {"step", "stencil", "agents", "colorize"};
+
+// returns NULL for the step, which only has a thread count
+struct PhaseTuning *get_phase(struct Tuning *tuning, int phase) {
+    switch (phase) {
+        case STENCIL_PHASE: return &tuning->stencil;
+        case AGENTS_PHASE: return &tuning->agents;
+        case COLORIZE_PHASE: return &tuning->colorize;
+        default: return NULL;
+    }
+}
+
+// returns NULL for the other phases, which run on the step's team
+int *get_threads(struct Tuning *tuning, int phase) {
+    return phase == STEP_PHASE ? &tuning->step_threads : NULL;
+}
+
+// tunes the thread count of a phase, keeping everything else of best
+struct Tuning tune_threads(struct TuneContext *ctx, struct Tuning best, int phase) {
+    double best_time = measure(ctx, best);
+    struct Tuning candidate = best;
+    for (int nthreads = 1; nthreads < omp_get_max_threads(); nthreads *= 2) {
+        *get_threads(&candidate, phase) = nthreads;
+        try_candidate(ctx, candidate, &best, &best_time);
+    }
+    return best;
+}
+
+// tunes the schedule, then the tile width of a phase, keeping the best value
+// of each before moving on to the next
+struct Tuning tune_loops(struct TuneContext *ctx, struct Tuning best, int phase, int tiled) {
+    double best_time = measure(ctx, best);
+    struct Tuning candidate = best;
+    for (size_t i = 0; i < sizeof(schedule_candidates) / sizeof(*schedule_candidates); i++) {
+        get_phase(&candidate, phase)->schedule = schedule_candidates[i].schedule;
+        get_phase(&candidate, phase)->chunk = schedule_candidates[i].chunk;
+        try_candidate(ctx, candidate, &best, &best_time);
+    }
+
+    candidate = best;
+    for (size_t i = 0; tiled && i < sizeof(tile_candidates) / sizeof(*tile_candidates); i++) {
+        // a tile as wide as the grid is the same as no tiling
+        if (tile_candidates[i] >= ctx->trail_map.width - 2) {
+            break;
+        }
+        get_phase(&candidate, phase)->tile_width = tile_candidates[i];
+        try_candidate(ctx, candidate, &best, &best_time);
+    }
+    return best;
+}
+
+const char *schedule_name(omp_sched_t schedule) {
+    switch (schedule) {
+        case omp_sched_static: return "static";
+        case omp_sched_dynamic: return "dynamic";
+        case omp_sched_guided: return "guided";
+        default: return "auto";
+    }
+}
+
+void print_phase(struct Tuning tuning, int phase) {
+    printf("%s:", phase_names[phase]);
+    int *threads = get_threads(&tuning, phase);
+    if (threads != NULL) {
+        printf(" threads=%d", *threads);
+    }
+    struct PhaseTuning *loops = get_phase(&tuning, phase);
+    if (loops != NULL) {
+        printf(" schedule=%s chunk=%d tile_width=%d", schedule_name(loops->schedule), loops->chunk, loops->tile_width);
+    }
+    printf("\n");
+}
+
+// returns -1 if there is no phase with that name
+int phase_index(const char *name) {
+    for (int i = 0; i < NPHASES; i++) {
+        if (strcmp(name, phase_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int valid_schedule(int schedule) {
+    return schedule == omp_sched_static || schedule == omp_sched_dynamic || schedule == omp_sched_guided;
+}
+
+// every line of the profile is
+// host width height nagents max_threads indexed analytics dynamic phase nthreads schedule chunk tile_width
+// the step only uses nthreads and the other phases ignore it
+// later lines replace earlier ones with the same key
+int load_profile(const char *filename, struct ProfileKey key, struct Tuning *tuning) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    char line[512];
+    struct ProfileKey line_key;
+    char phase[PHASE_NAME_LENGTH];
+    int nthreads, schedule;
+    struct PhaseTuning phase_tuning;
+    // bit for each phase that was found
+    int found = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        int n = sscanf(line, "%255s %d %d %d %d %d %d %d %15s %d %d %d %d", line_key.host, &line_key.width, &line_key.height, &line_key.nagents,
+                &line_key.max_threads, &line_key.indexed, &line_key.analytics, &line_key.dynamic, phase, &nthreads, &schedule, &phase_tuning.chunk, &phase_tuning.tile_width);
+        if (n != 13 || strcmp(line_key.host, key.host) != 0 || line_key.width != key.width || line_key.height != key.height
+                || line_key.nagents != key.nagents || line_key.max_threads != key.max_threads || line_key.indexed != key.indexed
+                || line_key.analytics != key.analytics || line_key.dynamic != key.dynamic) {
+            continue;
+        }
+        int index = phase_index(phase);
+        // reject profiles that ask for more threads than there are seeds, and
+        // schedules the tuner never picks
+        if (index == -1 || nthreads > omp_get_max_threads() || nthreads < 0
+                || !valid_schedule(schedule) || phase_tuning.chunk < 0 || phase_tuning.tile_width < 0) {
+            continue;
+        }
+        phase_tuning.schedule = (omp_sched_t) schedule;
+        if (get_threads(tuning, index) != NULL) {
+            *get_threads(tuning, index) = nthreads;
+        }
+        if (get_phase(tuning, index) != NULL) {
+            *get_phase(tuning, index) = phase_tuning;
+        }
+        found |= 1 << index;
+    }
+    fclose(file);
+    return found == (1 << NPHASES) - 1 ? 0 : -1;
+}
+
+void save_profile(const char *filename, struct ProfileKey key, struct Tuning tuning) {
+    FILE *file = fopen(filename, "a");
+    if (file == NULL) {
+        perror("Error saving tuning profile");
+        return;
+    }
+    struct PhaseTuning unused = default_tuning().stencil;
+    for (int i = 0; i < NPHASES; i++) {
+        int *threads = get_threads(&tuning, i);
+        struct PhaseTuning *phase = get_phase(&tuning, i);
+        if (phase == NULL) {
+            phase = &unused;
+        }
+        fprintf(file, "%s %d %d %d %d %d %d %d %s %d %d %d %d\n", key.host, key.width, key.height, key.nagents, key.max_threads, key.indexed, key.analytics, key.dynamic,
+                phase_names[i], threads != NULL ? *threads : 0, (int) phase->schedule, phase->chunk, phase->tile_width);
+    }
+    fclose(file);
+}
+
+struct Tuning autotune(const char *profile_filename, struct Map trail_map, struct Map food_map, struct AgentPool pool, unsigned int *seeds, struct IterationSettings settings, int analytics) {
+    struct ProfileKey key;
+    if (gethostname(key.host, sizeof(key.host)) == -1) {
+        strcpy(key.host, "unknown");
+    }
+    key.host[HOSTNAME_LENGTH - 1] = '\0';
+    key.width = trail_map.width;
+    key.height = trail_map.height;
+    key.nagents = pool.count;
+    key.max_threads = omp_get_max_threads();
+    key.indexed = settings.indexed;
+    key.analytics = analytics;
+    key.dynamic = settings.dynamic;
+
+    struct Tuning tuning = default_tuning();
+    if (load_profile(profile_filename, key, &tuning) == 0) {
+        printf("Loaded tuning profile from %s\n", profile_filename);
+    } else {
+        printf("Auto tuning...\n");
+        struct TuneContext ctx;
+        int ncells = trail_map.width * trail_map.height;
+        // iterations change the trail and the agents, so work on copies
+        ctx.trail_map = trail_map;
+        ctx.trail_map.grid = malloc_or_die(ncells * sizeof(*ctx.trail_map.grid));
+        memcpy(ctx.trail_map.grid, trail_map.grid, ncells * sizeof(*ctx.trail_map.grid));
+        ctx.trail_map.scratch = malloc_or_die(ncells * sizeof(*ctx.trail_map.scratch));
+        ctx.food_map = food_map;
+        struct Arena arena = arena_create(agent_pool_size(pool.count, pool.nthreads, settings.dynamic));
+        ctx.pool = agent_pool_create(&arena, pool.count, pool.nthreads, settings.dynamic);
+        ctx.agents = pool.agents;
+        ctx.nagents = pool.count;
+        ctx.agent_pos_freq = malloc_or_die(ncells * sizeof(*ctx.agent_pos_freq));
+        ctx.seeds = seeds;
+        ctx.settings = settings;
+        struct StepStats stats;
+        ctx.stats = analytics ? &stats : NULL;
+        ctx.frame = malloc_or_die(ncells * sizeof(*ctx.frame));
+
+        tuning = tune_threads(&ctx, tuning, STEP_PHASE);
+        tuning = tune_loops(&ctx, tuning, STENCIL_PHASE, 1);
+        tuning = tune_loops(&ctx, tuning, AGENTS_PHASE, 0);
+        tuning = tune_loops(&ctx, tuning, COLORIZE_PHASE, 0);
+
+        free(ctx.frame);
+        free(ctx.agent_pos_freq);
+        arena_destroy(&arena);
+        free(ctx.trail_map.scratch);
+        free(ctx.trail_map.grid);
+        save_profile(profile_filename, key, tuning);
+        printf("Saved tuning profile to %s\n", profile_filename);
+    }
+    for (int i = 0; i < NPHASES; i++) {
+        print_phase(tuning, i);
+    }
+    printf("\n");
+    return tuning;
+}
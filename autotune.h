@@ -0,0 +1,23 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "iteration.h"
+#include "population.h"
+#include "slimemold_simulation.h"
+#include "tune.h"
+
+/**
+ * Returns the tuning saved in the profile for this host and problem shape, or
+ * times candidate settings for every phase, picks the fastest and saves them
+ * to the profile.
+ *
+ * Every phase runs in the iteration's parallel region, so they are timed as
+ * whole iterations on copies of the given trail map and agents, which are left
+ * unchanged. The seeds are advanced.
+ * @param[in] profile_filename File the profiles are read from and appended to
+ * @param[in] pool The agents of the run, only read
+ * @param[in] analytics Whether the steps compute statistics
+ */
+struct Tuning autotune(const char *profile_filename, struct Map trail_map, struct Map food_map, struct AgentPool pool, unsigned int *seeds, struct IterationSettings settings, int analytics);
+
+#endif
@@ -1,9 +1,16 @@
+// for pipe2
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "encode_video.h"
+#include "util.h"
 
 #define FFMPEG_LOG_LEVEL "info"
 #define CODEC "libx265"
@@ -13,41 +20,73 @@
 #define CRF_FAST "20"
 #define ENCODER_PRESET_SLOW "veryslow"
 #define ENCODER_PRESET_FAST "veryfast"
+// segments are named after the output file
+#define SEGMENT_SUFFIX ".segment%04d.mkv"
+#define SEGMENT_LIST_SUFFIX ".segments.txt"
+// indexed frames are sent as native endian 16 bit gray
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define INDEXED_PIX_FMT "gray16be"
+#else
+#define INDEXED_PIX_FMT "gray16le"
+#endif
+#define EXEC_ERROR "Error: starting ffmpeg failed\n"
+
 
+// reports a failed exec from a forked child. The parent may have other
+// threads, so the child can only make async-signal-safe calls
+void exit_child(const char *message, size_t length) {
+    if (write(STDERR_FILENO, message, length) == -1) {
+        // nowhere left to report it
+    }
+    _exit(1);
+}
+
+int open_pipe(int fps, int width, int height, char* filename, enum EncoderPreset preset, const char* lut_filename, int* outfd, pid_t* pid) {
+    // convert arguments to strings before forking, the child may not call
+    // snprintf
+    char fpsbuf[256];
+    snprintf(fpsbuf, 256, "%d", fps);
+    char sizebuf[256];
+    snprintf(sizebuf, 256, "%dx%d", width, height);
+    // copies the index into all three planes and looks up the color of each,
+    // then drops to 8 bit gbrp so the encoder gets what the ppm path gave it
+    char filterbuf[4096];
+    if (lut_filename != NULL) {
+        snprintf(filterbuf, 4096, "mergeplanes=0x000000:gbrp16le,lut1d=file=%s:interp=nearest,format=gbrp", lut_filename);
+    }
+    // select crf and encoder preset
+    const char *crf = CRF_FAST;
+    const char *encoder_preset = ENCODER_PRESET_FAST;
+    if (preset == SLOW) {
+        crf = CRF_SLOW;
+        encoder_preset = ENCODER_PRESET_SLOW;
+    }
 
-int open_pipe(int fps, char* filename, enum EncoderPreset preset, int* outfd, pid_t* pid) {
     // create the pipe
+    // close on exec so encoders started by other segment workers don't hold
+    // this pipe open
     int pipefd[2];
-    if (pipe(pipefd) == -1) {
+    if (pipe2(pipefd, O_CLOEXEC) == -1) {
         return -1;
     }
     //initiate ffmpeg
     *pid = fork();
     if (*pid == -1) {
+        int error = errno;
+        close(pipefd[0]);
+        close(pipefd[1]);
+        errno = error;
         return -1;
     } else if(*pid == 0) {
-        // convert arguments to strings
-        char fpsbuf[256];
-        snprintf(fpsbuf, 256, "%d", fps);
-        // select crf and encoder preset
-        char crf[64];
-        char encoder_preset[64];
-        switch (preset) {
-            case SLOW:
-                strcpy(crf, CRF_SLOW);
-                strcpy(encoder_preset, ENCODER_PRESET_SLOW);
-                break;
-            case FAST:
-                strcpy(crf, CRF_FAST);
-                strcpy(encoder_preset, ENCODER_PRESET_FAST);
-                break;
-        }
-
         close(pipefd[1]);
         dup2(pipefd[0], STDIN_FILENO);
         close(pipefd[0]);
-        execlp("ffmpeg", "ffmpeg", "-hide_banner", "-loglevel", FFMPEG_LOG_LEVEL, "-f", "image2pipe", "-framerate", fpsbuf, "-i", "pipe:", "-c:v", CODEC, CODEC_PARAM, CODEC_LOG_LEVEL, "-crf", crf, "-preset", encoder_preset, filename, (char *) NULL);
-        return -1;
+        if (lut_filename == NULL) {
+            execlp("ffmpeg", "ffmpeg", "-hide_banner", "-loglevel", FFMPEG_LOG_LEVEL, "-f", "image2pipe", "-framerate", fpsbuf, "-i", "pipe:", "-c:v", CODEC, CODEC_PARAM, CODEC_LOG_LEVEL, "-crf", crf, "-preset", encoder_preset, filename, (char *) NULL);
+        } else {
+            execlp("ffmpeg", "ffmpeg", "-hide_banner", "-loglevel", FFMPEG_LOG_LEVEL, "-f", "rawvideo", "-pix_fmt", INDEXED_PIX_FMT, "-video_size", sizebuf, "-framerate", fpsbuf, "-i", "pipe:", "-vf", filterbuf, "-c:v", CODEC, CODEC_PARAM, CODEC_LOG_LEVEL, "-crf", crf, "-preset", encoder_preset, filename, (char *) NULL);
+        }
+        exit_child(EXEC_ERROR, sizeof(EXEC_ERROR) - 1);
     }
     close(pipefd[0]);
     *outfd = pipefd[1];
@@ -55,7 +94,295 @@ int open_pipe(int fps, char* filename, enum EncoderPreset preset, int* outfd, pi
     return 0;
 }
 
-void close_pipe(int outfd, pid_t pid) {
+int close_pipe(int outfd, pid_t pid) {
     close(outfd);
-    waitpid(pid, NULL, 0);
+    int status;
+    if (waitpid(pid, &status, 0) == -1) {
+        return -1;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+// writes the whole buffer, returns -1 on failure
+int write_all(int fd, const void *buf, size_t size) {
+    const char *bytes = buf;
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return 0;
+}
+
+void segment_filename(char *buf, size_t size, const char *filename, int segment) {
+    snprintf(buf, size, "%s" SEGMENT_SUFFIX, filename, segment);
+}
+
+// puts a frame back in the pool once it is written or dropped
+void return_segment_frame(struct SegmentedPipe *spipe, void *frame) {
+    pthread_mutex_lock(&spipe->pool_lock);
+    spipe->free_frames[spipe->nfree++] = frame;
+    pthread_cond_signal(&spipe->frame_returned);
+    pthread_mutex_unlock(&spipe->pool_lock);
+}
+
+void *run_segment_worker(void *arg) {
+    struct SegmentWorker *worker = arg;
+    struct SegmentedPipe *spipe = worker->spipe;
+    int segment = worker->id;
+    // frames written to the current segment, -1 if no encoder is running
+    int written = -1;
+    // after a failure the remaining frames are only returned to the pool, so
+    // the queue keeps draining and the main thread never blocks on it
+    int error = 0;
+    int outfd;
+    pid_t pid;
+    while (1) {
+        // wait for a frame
+        pthread_mutex_lock(&worker->lock);
+        while (worker->count == 0) {
+            pthread_cond_wait(&worker->changed, &worker->lock);
+        }
+        void *frame = worker->frames[worker->head];
+        pthread_mutex_unlock(&worker->lock);
+        if (frame == NULL) {
+            break;
+        }
+
+        if (error == 0 && written == -1) {
+            char name[4096];
+            segment_filename(name, sizeof(name), spipe->filename, segment);
+            if (open_pipe(spipe->fps, spipe->width, spipe->height, name, spipe->preset, spipe->lut_filename, &outfd, &pid) == -1) {
+                error = errno;
+            } else {
+                written = 0;
+            }
+        }
+        if (error == 0) {
+            if ((spipe->lut_filename == NULL && dprintf(outfd, "P6\n%d %d 255\n", spipe->width, spipe->height) < 0)
+                    || write_all(outfd, frame, spipe->frame_size) == -1) {
+                error = errno;
+                close_pipe(outfd, pid);
+                written = -1;
+            } else {
+                written++;
+            }
+        }
+        return_segment_frame(spipe, frame);
+        // finish the segment, the next one for this worker is nworkers later.
+        // FFmpeg can still fail after reading every frame
+        if (written == spipe->segment_frames) {
+            if (close_pipe(outfd, pid) == -1) {
+                error = errno;
+            }
+            written = -1;
+            segment += spipe->nworkers;
+        }
+
+        // only remove the frame after writing it so the queue bounds memory
+        pthread_mutex_lock(&worker->lock);
+        worker->error = error;
+        worker->head = (worker->head + 1) % spipe->segment_frames;
+        worker->count--;
+        pthread_cond_signal(&worker->changed);
+        pthread_mutex_unlock(&worker->lock);
+    }
+    if (written != -1 && close_pipe(outfd, pid) == -1) {
+        pthread_mutex_lock(&worker->lock);
+        worker->error = errno;
+        pthread_mutex_unlock(&worker->lock);
+    }
+    return NULL;
+}
+
+// adds a frame to the back of the worker's queue, blocks while it is full
+void queue_frame(struct SegmentWorker *worker, void *frame) {
+    int capacity = worker->spipe->segment_frames;
+    pthread_mutex_lock(&worker->lock);
+    while (worker->count == capacity) {
+        pthread_cond_wait(&worker->changed, &worker->lock);
+    }
+    worker->frames[(worker->head + worker->count) % capacity] = frame;
+    worker->count++;
+    pthread_cond_signal(&worker->changed);
+    pthread_mutex_unlock(&worker->lock);
+}
+
+// ends every worker's queue, waits for the workers and frees them
+// returns the first error of a worker, 0 if there was none
+int stop_workers(struct SegmentedPipe *spipe) {
+    int error = 0;
+    for (int i = 0; i < spipe->nworkers; i++) {
+        queue_frame(&spipe->workers[i], NULL);
+    }
+    for (int i = 0; i < spipe->nworkers; i++) {
+        struct SegmentWorker *worker = &spipe->workers[i];
+        pthread_join(worker->thread, NULL);
+        if (error == 0) {
+            error = worker->error;
+        }
+        pthread_mutex_destroy(&worker->lock);
+        pthread_cond_destroy(&worker->changed);
+        free(worker->frames);
+    }
+    free(spipe->workers);
+    pthread_mutex_destroy(&spipe->pool_lock);
+    pthread_cond_destroy(&spipe->frame_returned);
+    free(spipe->free_frames);
+    return error;
+}
+
+size_t segmented_pipe_size(size_t frame_size, int nworkers, int segment_frames) {
+    return arena_block_size(frame_size * (nworkers * segment_frames + 1));
+}
+
+int open_segmented_pipe(int fps, int width, int height, char* filename, enum EncoderPreset preset, const char* lut_filename, int nworkers, int segment_frames, struct Arena *arena, struct SegmentedPipe* spipe) {
+    spipe->fps = fps;
+    spipe->width = width;
+    spipe->height = height;
+    spipe->filename = filename;
+    spipe->preset = preset;
+    spipe->lut_filename = lut_filename;
+    // indexed frames have 2 bytes per pixel, rgb frames 3
+    spipe->frame_size = (size_t) width * height * (lut_filename == NULL ? 3 : 2);
+    spipe->nworkers = nworkers;
+    spipe->segment_frames = segment_frames;
+    spipe->nframes = 0;
+    // every queue can be full while the main thread fills one more frame
+    int pool_frames = nworkers * segment_frames + 1;
+    char *frames = arena_alloc(arena, spipe->frame_size * pool_frames);
+    spipe->free_frames = malloc_or_die(pool_frames * sizeof(*spipe->free_frames));
+    for (int i = 0; i < pool_frames; i++) {
+        spipe->free_frames[i] = frames + i * spipe->frame_size;
+    }
+    spipe->nfree = pool_frames;
+    pthread_mutex_init(&spipe->pool_lock, NULL);
+    pthread_cond_init(&spipe->frame_returned, NULL);
+    spipe->workers = malloc_or_die(nworkers * sizeof(*spipe->workers));
+    for (int i = 0; i < nworkers; i++) {
+        struct SegmentWorker *worker = &spipe->workers[i];
+        worker->spipe = spipe;
+        worker->id = i;
+        worker->frames = malloc_or_die(segment_frames * sizeof(*worker->frames));
+        worker->head = 0;
+        worker->count = 0;
+        worker->error = 0;
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->changed, NULL);
+        int error = pthread_create(&worker->thread, NULL, run_segment_worker, worker);
+        if (error != 0) {
+            // stop the workers that did start, they have no encoders running yet
+            pthread_mutex_destroy(&worker->lock);
+            pthread_cond_destroy(&worker->changed);
+            free(worker->frames);
+            spipe->nworkers = i;
+            stop_workers(spipe);
+            errno = error;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void *take_segment_frame(struct SegmentedPipe* spipe) {
+    pthread_mutex_lock(&spipe->pool_lock);
+    while (spipe->nfree == 0) {
+        pthread_cond_wait(&spipe->frame_returned, &spipe->pool_lock);
+    }
+    void *frame = spipe->free_frames[--spipe->nfree];
+    pthread_mutex_unlock(&spipe->pool_lock);
+    return frame;
+}
+
+int write_segment_frame(struct SegmentedPipe* spipe, void* frame) {
+    int segment = spipe->nframes / spipe->segment_frames;
+    struct SegmentWorker *worker = &spipe->workers[segment % spipe->nworkers];
+    pthread_mutex_lock(&worker->lock);
+    int error = worker->error;
+    pthread_mutex_unlock(&worker->lock);
+    if (error != 0) {
+        return_segment_frame(spipe, frame);
+        errno = error;
+        return -1;
+    }
+    queue_frame(worker, frame);
+    spipe->nframes++;
+    return 0;
+}
+
+// writes a list of the segments for FFmpeg's concat demuxer
+int write_segment_list(const char *list_filename, struct SegmentedPipe *spipe, int nsegments) {
+    FILE *file = fopen(list_filename, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    // paths in the list are relative to it, and it is next to the segments
+    const char *base = strrchr(spipe->filename, '/');
+    base = base == NULL ? spipe->filename : base + 1;
+    for (int i = 0; i < nsegments; i++) {
+        char name[4096];
+        segment_filename(name, sizeof(name), base, i);
+        fprintf(file, "file '");
+        // quotes are escaped by closing the string, adding \' and reopening it
+        for (char *c = name; *c != '\0'; c++) {
+            if (*c == '\'') {
+                fprintf(file, "'\\''");
+            } else {
+                fputc(*c, file);
+            }
+        }
+        fprintf(file, "'\n");
+    }
+    return fclose(file);
+}
+
+int close_segmented_pipe(struct SegmentedPipe* spipe) {
+    // tell each worker the video is done and wait for its encoders
+    int error = stop_workers(spipe);
+    if (error != 0) {
+        fprintf(stderr, "Error encoding segments: %s, they are kept\n", strerror(error));
+        return -1;
+    }
+
+    int nsegments = (spipe->nframes + spipe->segment_frames - 1) / spipe->segment_frames;
+    char list_filename[4096];
+    snprintf(list_filename, sizeof(list_filename), "%s" SEGMENT_LIST_SUFFIX, spipe->filename);
+    if (write_segment_list(list_filename, spipe, nsegments) == -1) {
+        perror("Error writing the segment list");
+        return -1;
+    }
+
+    // join the segments without reencoding
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("Error");
+        return -1;
+    } else if (pid == 0) {
+        execlp("ffmpeg", "ffmpeg", "-hide_banner", "-loglevel", FFMPEG_LOG_LEVEL, "-f", "concat", "-safe", "0", "-i", list_filename, "-c", "copy", spipe->filename, (char *) NULL);
+        exit_child(EXEC_ERROR, sizeof(EXEC_ERROR) - 1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Error: concatenating segments failed, they are kept\n");
+        return -1;
+    }
+
+    unlink(list_filename);
+    for (int i = 0; i < nsegments; i++) {
+        char name[4096];
+        segment_filename(name, sizeof(name), spipe->filename, i);
+        unlink(name);
+    }
+    return 0;
 }
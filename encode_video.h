@@ -3,14 +3,26 @@
 
 
 
+#include <pthread.h>
+#include <stddef.h>
 #include <sys/types.h>
 
+#include "util.h"
+
 /** @file
  * @brief Encodes a series of frames as a video.
  *
  * Works by launching FFmpeg as a separate process and opening a pipe to it.
  * Encodes the video as HEVC. Each must be the wqme size and in the same image
  * format such as ppm.
+ *
+ * Alternatively, frames can be sent as raw 16 bit indices which FFmpeg turns
+ * into colors with a 1D LUT, which cuts the data sent through the pipe.
+ *
+ * For slow presets a single FFmpeg process cannot keep up, so the frames can
+ * also be split into fixed length segments that are encoded by a pool of
+ * FFmpeg processes at the same time and concatenated without reencoding at
+ * the end.
  */
 
 /// Determines the settings for the encoder. Affects encoding time and quality.
@@ -19,18 +31,117 @@ enum EncoderPreset {SLOW, FAST};
 /**
  * Launches FFmpeg by forking the current process and creates a pipe with it.
  * @param[in] fps Frames per seconds of the video
+ * @param[in] width Width of each frame, only used for indexed frames
+ * @param[in] height Height of each frame, only used for indexed frames
  * @param[in] filename Filename of the output video
  * @param[in] preset Determines encoding speed and quality
+ * @param[in] lut_filename .cube LUT that maps 16 bit indexed frames to colors,
+ *            NULL if the frames are ppm images
  * @param[out] outfd Write end of pipe
  * @param[out] pid pid of child process
  * @return -1 if an error occured, 0 otherwise
  */
-int open_pipe(int fps, char* filename, enum EncoderPreset preset, int* outfd, pid_t* pid);
+int open_pipe(int fps, int width, int height, char* filename, enum EncoderPreset preset, const char* lut_filename, int* outfd, pid_t* pid);
 
 /**
  * Cleans up by closing the write end of the pipe and waits for the child to exit.
  * @param[in] outfd File descriptor for the write end of the pipe
  * @param[in] pid Pid of the child process
+ * @return -1 with errno set if waiting failed or FFmpeg exited with an
+ *         error, which sets errno to EIO, 0 otherwise
+ */
+int close_pipe(int outfd, pid_t pid);
+
+/// Feeds the segments given to one FFmpeg process of a SegmentedPipe.
+struct SegmentWorker {
+    struct SegmentedPipe *spipe;
+    int id;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    /// Queued frames, a NULL frame marks the end of the video
+    void **frames;
+    int head;
+    int count;
+    /// errno of the worker's first failure, 0 if none
+    int error;
+};
+
+/// A pool of FFmpeg processes that each encode every nworkers-th segment.
+struct SegmentedPipe {
+    int fps;
+    int width;
+    int height;
+    char *filename;
+    enum EncoderPreset preset;
+    const char *lut_filename;
+    /// Size in bytes of every frame
+    size_t frame_size;
+    int nworkers;
+    /// Frames in a segment, every segment starts with a new GOP
+    int segment_frames;
+    /// Frames written so far
+    int nframes;
+    struct SegmentWorker *workers;
+    /// Frames that are neither queued nor being filled
+    void **free_frames;
+    int nfree;
+    pthread_mutex_t pool_lock;
+    pthread_cond_t frame_returned;
+};
+
+/**
+ * Returns the arena space open_segmented_pipe needs for its frames.
+ * @param[in] frame_size Size in bytes of every frame, 2 bytes per pixel for
+ *            indexed frames and 3 for rgb frames
+ */
+size_t segmented_pipe_size(size_t frame_size, int nworkers, int segment_frames);
+
+/**
+ * Starts a pool of threads that encode the video in segments, each one by a
+ * separate FFmpeg process. Each worker queues up to a segment of frames, so
+ * nworkers * segment_frames + 1 frames are taken from the arena up front and
+ * reused, and writing frames never allocates.
+ * @param[in] fps Frames per seconds of the video
+ * @param[in] width Width of each frame
+ * @param[in] height Height of each frame
+ * @param[in] filename Filename of the output video
+ * @param[in] preset Determines encoding speed and quality
+ * @param[in] lut_filename .cube LUT that maps 16 bit indexed frames to colors,
+ *            NULL if the frames are rgb images, the ppm header is added
+ * @param[in] nworkers Number of FFmpeg processes running at once
+ * @param[in] segment_frames Number of frames in each segment
+ * @param[in] arena Arena the frames are allocated from, it must outlive the pipe
+ * @param[out] spipe The segmented pipe
+ * @return -1 with errno set if an error occured, 0 otherwise
+ */
+int open_segmented_pipe(int fps, int width, int height, char* filename, enum EncoderPreset preset, const char* lut_filename, int nworkers, int segment_frames, struct Arena *arena, struct SegmentedPipe* spipe);
+
+/**
+ * Takes a frame of spipe->frame_size bytes from the pool to fill and pass to
+ * write_segment_frame. Blocks until a worker returns one if none are free.
+ * @param[in] spipe The segmented pipe
+ * @return The frame
+ */
+void *take_segment_frame(struct SegmentedPipe* spipe);
+
+/**
+ * Queues a frame for the worker encoding its segment. Blocks while that
+ * worker's queue is full.
+ * @param[in] spipe The segmented pipe
+ * @param[in] frame Frame from take_segment_frame, it goes back to the pool
+ *            once written or if the worker failed
+ * @return -1 with errno set if that worker failed to encode an earlier
+ *         frame, 0 otherwise
+ */
+int write_segment_frame(struct SegmentedPipe* spipe, void* frame);
+
+/**
+ * Waits for every segment to be encoded, then concatenates them into the
+ * output file and removes them. If a worker failed or the concatenation
+ * failed, the error is printed and the segments are kept.
+ * @param[in] spipe The segmented pipe
+ * @return -1 if an error occured, 0 otherwise
  */
-void close_pipe(int outfd, pid_t pid);
+int close_segmented_pipe(struct SegmentedPipe* spipe);
 #endif
@@ -0,0 +1,62 @@
+#include <string.h>
+
+#include "iteration.h"
+
+// fills the frame from a trail grid, called by every thread of a team
+void fill_frame_team(void *frame, struct Map trail_map, struct Map food_map, struct IterationSettings settings, struct PhaseTuning tuning) {
+    if (settings.indexed) {
+        index_image_team(frame, trail_map.grid, food_map.grid, trail_map.width, trail_map.height, settings.colormap, settings.behavior.trail_max, settings.food_maxval, tuning);
+    } else {
+        color_image_team(frame, trail_map.grid, food_map.grid, trail_map.width, trail_map.height, settings.colormap, settings.behavior.trail_max, settings.food_maxval, tuning);
+    }
+}
+
+void simulate_iteration(struct Map *p_trail_map, struct Map food_map, struct AgentPool *pool, int *agent_pos_freq, unsigned int *seeds, struct IterationSettings settings, int compact, void *frame, struct Tuning tuning, struct StepStats *stats) {
+    struct Map next_map = step_next_map(*p_trail_map);
+    compact = settings.dynamic && compact;
+    int total = 0;
+    if (stats != NULL) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    #pragma omp parallel num_threads(tuned_threads(tuning.step_threads))
+    {
+        simulate_step_team(*p_trail_map, next_map, food_map, pool->agents, pool->count, settings.dynamic, settings.behavior, agent_pos_freq, seeds, tuning, stats);
+        // the frame needs every deposit, and the update changes the energy
+        // the deposit tests
+        #pragma omp barrier
+        // the update only touches agents and the frame only reads the trail,
+        // so they share the next barrier
+        if (settings.dynamic) {
+            update_population_team(pool, food_map, settings.food_maxval, agent_pos_freq, settings.population, seeds, tuning.agents);
+        }
+        fill_frame_team(frame, next_map, food_map, settings, tuning.colorize);
+        if (compact) {
+            // compaction moves agents other threads may still be updating
+            #pragma omp barrier
+            compact_agents_team(pool, &total);
+        }
+    }
+    if (stats != NULL) {
+        finish_occupancy_entropy(stats);
+    }
+    *p_trail_map = next_map;
+    if (compact) {
+        finish_compaction(pool, total);
+    }
+}
+
+void simulate_iteration_split(struct Map *p_trail_map, struct Map food_map, struct AgentPool *pool, int *agent_pos_freq, unsigned int *seeds, struct IterationSettings settings, int compact, void *frame, struct Tuning tuning, struct StepStats *stats) {
+    simulate_step_split(p_trail_map, food_map, pool->agents, pool->count, settings.dynamic, settings.behavior, agent_pos_freq, seeds, tuning, stats);
+    if (settings.dynamic) {
+        update_population(pool, food_map, settings.food_maxval, agent_pos_freq, settings.population, seeds, 0, tuning.agents);
+        if (compact) {
+            compact_agents(pool, 0);
+        }
+    }
+    struct Map trail_map = *p_trail_map;
+    if (settings.indexed) {
+        index_image(frame, trail_map.grid, food_map.grid, trail_map.width, trail_map.height, settings.colormap, settings.behavior.trail_max, settings.food_maxval, 0, tuning.colorize);
+    } else {
+        color_image(frame, trail_map.grid, food_map.grid, trail_map.width, trail_map.height, settings.colormap, settings.behavior.trail_max, settings.food_maxval, 0, tuning.colorize);
+    }
+}
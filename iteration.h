@@ -0,0 +1,47 @@
+#ifndef ITERATION_H
+#define ITERATION_H
+
+#include "population.h"
+#include "process_image.h"
+#include "slimemold_simulation.h"
+#include "tune.h"
+
+/** @file
+ * @brief Runs one iteration of the main loop in a single parallel region.
+ *
+ * An iteration steps the simulation, updates the population, compacts the
+ * agents when it is due and fills the frame. Opening a region for each of
+ * them costs a fork and a join every frame, which on small grids is a large
+ * part of the work, so they all run on one team that only meets at the
+ * barriers the data needs.
+ */
+
+/// Everything of an iteration that stays the same for the whole run
+struct IterationSettings {
+    struct Behavior behavior;
+    struct PopulationBehavior population;
+    /// Whether agents can die and spawn
+    int dynamic;
+    struct ColorMap colormap;
+    double food_maxval;
+    /// Whether the frame is filled by index_image or color_image
+    int indexed;
+};
+
+/**
+ * Steps the simulation, then updates the population if it is dynamic and
+ * fills the frame from the new trail, all on a team of tuning.step_threads.
+ * @param[in] compact Whether to compact the agents after the update, only
+ *            used if the population is dynamic
+ * @param[out] frame Frame of the kind given by settings.indexed
+ * @param[out] stats Statistics of the step, or NULL to skip them
+ */
+void simulate_iteration(struct Map *p_trail_map, struct Map food_map, struct AgentPool *pool, int *agent_pos_freq, unsigned int *seeds, struct IterationSettings settings, int compact, void *frame, struct Tuning tuning, struct StepStats *stats);
+
+/**
+ * Same as simulate_iteration, but with a parallel region for every phase as
+ * the main loop used to run, to measure and check the single region against.
+ */
+void simulate_iteration_split(struct Map *p_trail_map, struct Map food_map, struct AgentPool *pool, int *agent_pos_freq, unsigned int *seeds, struct IterationSettings settings, int compact, void *frame, struct Tuning tuning, struct StepStats *stats);
+
+#endif
@@ -0,0 +1,142 @@
+#include <math.h>
+#include <omp.h>
+#include <string.h>
+
+#include "population.h"
+
+size_t agent_pool_size(int capacity, int nthreads, int dynamic) {
+    size_t size = arena_block_size((size_t) capacity * sizeof(struct Agent));
+    if (dynamic) {
+        // spare array, spawn buffers, spawn counts and block counts
+        size += arena_block_size((size_t) capacity * sizeof(struct Agent));
+        size += arena_block_size((size_t) (capacity / nthreads + 1) * nthreads * sizeof(struct Agent));
+        size += 2 * arena_block_size(nthreads * sizeof(int));
+    }
+    return size;
+}
+
+struct AgentPool agent_pool_create(struct Arena *arena, int capacity, int nthreads, int dynamic) {
+    struct AgentPool pool;
+    pool.agents = arena_alloc(arena, (size_t) capacity * sizeof(*pool.agents));
+    pool.count = 0;
+    pool.capacity = capacity;
+    pool.nthreads = nthreads;
+    if (!dynamic) {
+        pool.spare = NULL;
+        pool.spawns = NULL;
+        pool.spawn_counts = NULL;
+        pool.spawn_capacity = 0;
+        pool.block_counts = NULL;
+        return pool;
+    }
+    pool.spare = arena_alloc(arena, (size_t) capacity * sizeof(*pool.spare));
+    // spawns can't take up more than the whole pool between compactions
+    pool.spawn_capacity = capacity / nthreads + 1;
+    pool.spawns = arena_alloc(arena, (size_t) pool.spawn_capacity * nthreads * sizeof(*pool.spawns));
+    pool.spawn_counts = arena_alloc(arena, nthreads * sizeof(*pool.spawn_counts));
+    pool.block_counts = arena_alloc(arena, nthreads * sizeof(*pool.block_counts));
+    return pool;
+}
+
+void update_population_team(struct AgentPool *pool, struct Map food_map, double food_maxval, int *agent_pos_freq, struct PopulationBehavior behavior, unsigned int *seeds, struct PhaseTuning tuning) {
+    apply_schedule(tuning);
+    int thread = omp_get_thread_num();
+    // copies the values to avoid false sharing
+    unsigned int seed = seeds[thread];
+    int nspawns = pool->spawn_counts[thread];
+    struct Agent *spawns = &pool->spawns[(size_t) thread * pool->spawn_capacity];
+    #pragma omp for schedule(runtime) nowait
+    for (int i = 0; i < pool->count; i++) {
+        struct Agent *agent = &pool->agents[i];
+        if (agent->energy <= 0) {
+            continue;
+        }
+        int index = (int) agent->y * food_map.width + (int) agent->x;
+        agent->energy += behavior.food_energy * food_map.grid[index] / food_maxval - behavior.metabolism;
+
+        int freq = agent_pos_freq[index];
+        if (freq > behavior.crowd_threshold) {
+            // more likely the more crowded the cell is
+            double death_chance = behavior.crowd_death_rate * (freq - behavior.crowd_threshold) / behavior.crowd_threshold;
+            if (randd(0, 1, &seed) < death_chance) {
+                agent->energy = 0;
+            }
+        }
+        if (agent->energy <= 0) {
+            continue;
+        }
+
+        // split into two agents with half the energy each
+        if (agent->energy >= behavior.spawn_energy && nspawns < pool->spawn_capacity) {
+            agent->energy /= 2;
+            struct Agent *child = &spawns[nspawns++];
+            *child = *agent;
+            child->direction = randd(0, 2 * M_PI, &seed);
+        }
+    }
+    pool->spawn_counts[thread] = nspawns;
+    seeds[thread] = seed;
+}
+
+void update_population(struct AgentPool *pool, struct Map food_map, double food_maxval, int *agent_pos_freq, struct PopulationBehavior behavior, unsigned int *seeds, int nthreads, struct PhaseTuning tuning) {
+    #pragma omp parallel num_threads(tuned_threads(nthreads))
+    update_population_team(pool, food_map, food_maxval, agent_pos_freq, behavior, seeds, tuning);
+}
+
+void compact_agents_team(struct AgentPool *pool, int *p_total) {
+    int thread = omp_get_thread_num();
+    int nteam = omp_get_num_threads();
+    // each thread keeps the same contiguous block in both passes
+    int start = (long) pool->count * thread / nteam;
+    int end = (long) pool->count * (thread + 1) / nteam;
+    int live = 0;
+    for (int i = start; i < end; i++) {
+        live += pool->agents[i].energy > 0;
+    }
+    pool->block_counts[thread] = live;
+    #pragma omp barrier
+
+    // the live agents of this block go after those of the blocks before it
+    int offset = 0;
+    int all_live = 0;
+    for (int i = 0; i < nteam; i++) {
+        offset += i < thread ? pool->block_counts[i] : 0;
+        all_live += pool->block_counts[i];
+    }
+    for (int i = start; i < end; i++) {
+        if (pool->agents[i].energy > 0) {
+            pool->spare[offset++] = pool->agents[i];
+        }
+    }
+
+    // then the spawn buffers in order, each copied by one of the threads
+    int spawn_offset = all_live;
+    for (int i = 0; i < pool->nthreads; i++) {
+        int n = pool->spawn_counts[i];
+        if (spawn_offset + n > pool->capacity) {
+            n = pool->capacity - spawn_offset;
+        }
+        if (i % nteam == thread && n > 0) {
+            memcpy(&pool->spare[spawn_offset], &pool->spawns[(size_t) i * pool->spawn_capacity], n * sizeof(*pool->spare));
+        }
+        spawn_offset += n;
+    }
+    if (thread == 0) {
+        *p_total = spawn_offset;
+    }
+}
+
+void finish_compaction(struct AgentPool *pool, int total) {
+    memset(pool->spawn_counts, 0, pool->nthreads * sizeof(*pool->spawn_counts));
+    struct Agent *compacted = pool->spare;
+    pool->spare = pool->agents;
+    pool->agents = compacted;
+    pool->count = total;
+}
+
+void compact_agents(struct AgentPool *pool, int nthreads) {
+    int total = 0;
+    #pragma omp parallel num_threads(tuned_threads(nthreads))
+    compact_agents_team(pool, &total);
+    finish_compaction(pool, total);
+}
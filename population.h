@@ -0,0 +1,91 @@
+#ifndef POPULATION_H
+#define POPULATION_H
+
+#include "slimemold_simulation.h"
+#include "tune.h"
+#include "util.h"
+
+/** @file
+ * @brief Lets agents spawn and die without allocating during the simulation.
+ *
+ * Agents gain energy on food and lose a little every step. An agent with
+ * enough energy splits in two, so the population grows near food, and an
+ * agent dies when it runs out of energy or sometimes when its cell is
+ * crowded. Dead agents stay in place and are skipped by the simulation,
+ * while new agents wait in per thread spawn buffers. Every so often
+ * compact_agents packs the live agents and the spawns into a dense array
+ * again. All the memory is taken from an arena up front.
+ */
+
+/// Parameters that control how the population changes
+struct PopulationBehavior {
+    /// Energy gained in one step on a cell with the most food
+    double food_energy;
+    /// Energy lost every step
+    double metabolism;
+    /// An agent with at least this much energy splits in two
+    double spawn_energy;
+    /// Agents in a cell above which they may die of crowding, at least 1
+    int crowd_threshold;
+    /// Chance of dying each step for an agent in a cell with twice the threshold
+    double crowd_death_rate;
+};
+
+/// Storage for a population that can change up to a fixed capacity
+struct AgentPool {
+    /// Agents that are alive or died since the last compaction
+    struct Agent *agents;
+    int count;
+    int capacity;
+    /// Compaction writes the live agents here, then swaps it with agents
+    struct Agent *spare;
+    /// One buffer of spawn_capacity agents for each thread
+    struct Agent *spawns;
+    int *spawn_counts;
+    int spawn_capacity;
+    /// Number of spawn buffers, the most threads a phase can run on
+    int nthreads;
+    /// Live agents in each thread's part of the pool while compacting
+    int *block_counts;
+};
+
+/**
+ * Returns the arena space agent_pool_create needs.
+ */
+size_t agent_pool_size(int capacity, int nthreads, int dynamic);
+
+/**
+ * Creates an empty pool from the arena.
+ * @param[in] capacity Most agents the pool can hold
+ * @param[in] nthreads Most threads update_population and compact_agents run on
+ * @param[in] dynamic If 0, only the agents are allocated and the population
+ *            can't change
+ */
+struct AgentPool agent_pool_create(struct Arena *arena, int capacity, int nthreads, int dynamic);
+
+/**
+ * Feeds every live agent from the food map, then lets it die or split. New
+ * agents are added by the next compact_agents.
+ *
+ * Crowding is judged from agent_pos_freq as recorded by the last step.
+ */
+void update_population(struct AgentPool *pool, struct Map food_map, double food_maxval, int *agent_pos_freq, struct PopulationBehavior behavior, unsigned int *seeds, int nthreads, struct PhaseTuning tuning);
+
+/**
+ * Removes dead agents and appends the spawned ones, keeping the order of the
+ * live agents. Spawns that don't fit in the pool are dropped.
+ */
+void compact_agents(struct AgentPool *pool, int nthreads);
+
+/**
+ * The bodies of update_population and compact_agents, called by every thread
+ * of a team so they can run in the simulation's parallel region.
+ * update_population_team ends without a barrier. compact_agents_team must
+ * start after every thread finished updating the population, and leaves the
+ * new count in *p_total for finish_compaction to apply after the region.
+ */
+void update_population_team(struct AgentPool *pool, struct Map food_map, double food_maxval, int *agent_pos_freq, struct PopulationBehavior behavior, unsigned int *seeds, struct PhaseTuning tuning);
+void compact_agents_team(struct AgentPool *pool, int *p_total);
+void finish_compaction(struct AgentPool *pool, int total);
+
+#endif
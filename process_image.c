@@ -12,6 +12,11 @@
 // value from 0 to 1, with 0 being invisible and 1 being maximally visible
 #define FOOD_VISIBILITY 0.5
 
+// an indexed pixel stores the colormap index in its high bits and the food in the rest
+#define INDEX_TRAIL_BITS 10
+#define INDEX_FOOD_BITS 6
+#define FOOD_LEVELS_MAX ((1 << INDEX_FOOD_BITS) - 1)
+
 struct ColorMap load_colormap(const char *filename) {
     struct ColorMap cmap;
     int arraysize = ARRAY_RESIZE_INCREMENT;
@@ -90,31 +95,98 @@ void destroy_colormap(struct ColorMap colormap) {
     free(colormap.colors);
 }
 
-struct Color color_pixel(double trail_val, double food_val, struct ColorMap colormap, double trail_maxval, double food_maxval) {
-    struct Color color;
+// gets the index in the colormap for a trail value between 0 and trail_maxval
+int colormap_index(double trail_val, struct ColorMap colormap, double trail_maxval) {
     int trail_index = (int) trail_val * (colormap.length / trail_maxval);
     // highest value will be out of bounds
     if (trail_index == colormap.length) {
         trail_index--;
     }
-    struct Color trail_color = colormap.colors[trail_index];
-    // treat the food color as if it has a certain transparency alpha
-    double food_alpha = FOOD_VISIBILITY * food_val / food_maxval;
+    return trail_index;
+}
+
+// treat the food color as if it has a certain transparency alpha over the trail color
+struct Color blend_food(struct Color trail_color, double food_alpha) {
+    struct Color color;
     color.r = trail_color.r * (1 - food_alpha);
     color.g = trail_color.g * (1 - food_alpha) + 255 * food_alpha;
     color.b = trail_color.b * (1 - food_alpha);
     return color;
 }
 
-struct Color* color_image(double *trail_grid, double *food_grid, int width, int height, struct ColorMap colormap, double trail_maxval, double food_maxval) {
-    struct Color *new_image = malloc_or_die(width * height *sizeof(*new_image));
-    #pragma omp parallel for
+struct Color color_pixel(double trail_val, double food_val, struct ColorMap colormap, double trail_maxval, double food_maxval) {
+    struct Color trail_color = colormap.colors[colormap_index(trail_val, colormap, trail_maxval)];
+    double food_alpha = FOOD_VISIBILITY * food_val / food_maxval;
+    return blend_food(trail_color, food_alpha);
+}
+
+void color_image_team(struct Color *image, double *trail_grid, double *food_grid, int width, int height, struct ColorMap colormap, double trail_maxval, double food_maxval, struct PhaseTuning tuning) {
+    apply_schedule(tuning);
+    #pragma omp for schedule(runtime) nowait
     for (int row = 0; row < height; row++) {
         for (int col = 0; col < width; col++) {
             double trail_val = fmax(fmin(trail_grid[row * width + col], trail_maxval), 0);
             double food_val = fmax(fmin(food_grid[row * width + col], food_maxval), 0);
-            new_image[row * width + col] = color_pixel(trail_val, food_val, colormap, trail_maxval, food_maxval);
+            image[row * width + col] = color_pixel(trail_val, food_val, colormap, trail_maxval, food_maxval);
         }
     }
-    return new_image;
+}
+
+void color_image(struct Color *image, double *trail_grid, double *food_grid, int width, int height, struct ColorMap colormap, double trail_maxval, double food_maxval, int nthreads, struct PhaseTuning tuning) {
+    #pragma omp parallel num_threads(tuned_threads(nthreads))
+    color_image_team(image, trail_grid, food_grid, width, height, colormap, trail_maxval, food_maxval, tuning);
+}
+
+// packs the colormap index in the high bits and the quantized food value in the low bits
+uint16_t index_pixel(double trail_val, double food_val, struct ColorMap colormap, double trail_maxval, double food_maxval) {
+    int trail_index = colormap_index(trail_val, colormap, trail_maxval);
+    int food_level = (int) round(food_val / food_maxval * FOOD_LEVELS_MAX);
+    return (uint16_t) ((trail_index << INDEX_FOOD_BITS) | food_level);
+}
+
+void index_image_team(uint16_t *image, double *trail_grid, double *food_grid, int width, int height, struct ColorMap colormap, double trail_maxval, double food_maxval, struct PhaseTuning tuning) {
+    apply_schedule(tuning);
+    #pragma omp for schedule(runtime) nowait
+    for (int row = 0; row < height; row++) {
+        for (int col = 0; col < width; col++) {
+            double trail_val = fmax(fmin(trail_grid[row * width + col], trail_maxval), 0);
+            double food_val = fmax(fmin(food_grid[row * width + col], food_maxval), 0);
+            image[row * width + col] = index_pixel(trail_val, food_val, colormap, trail_maxval, food_maxval);
+        }
+    }
+}
+
+void index_image(uint16_t *image, double *trail_grid, double *food_grid, int width, int height, struct ColorMap colormap, double trail_maxval, double food_maxval, int nthreads, struct PhaseTuning tuning) {
+    #pragma omp parallel num_threads(tuned_threads(nthreads))
+    index_image_team(image, trail_grid, food_grid, width, height, colormap, trail_maxval, food_maxval, tuning);
+}
+
+int write_colormap_lut(const char *filename, struct ColorMap colormap) {
+    if (colormap.length > (1 << INDEX_TRAIL_BITS)) {
+        fprintf(stderr, "Error: colormap has %d colors, indexed frames support at most %d\n", colormap.length, 1 << INDEX_TRAIL_BITS);
+        return -1;
+    }
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        perror("Error");
+        return -1;
+    }
+    // every channel of the gray index is looked up in its own column, so each
+    // row is the final color of one index
+    fprintf(file, "LUT_1D_SIZE %d\n", 1 << (INDEX_TRAIL_BITS + INDEX_FOOD_BITS));
+    for (int i = 0; i < 1 << (INDEX_TRAIL_BITS + INDEX_FOOD_BITS); i++) {
+        int trail_index = i >> INDEX_FOOD_BITS;
+        // unused indices repeat the last color
+        if (trail_index >= colormap.length) {
+            trail_index = colormap.length - 1;
+        }
+        double food_alpha = FOOD_VISIBILITY * (i & FOOD_LEVELS_MAX) / FOOD_LEVELS_MAX;
+        struct Color color = blend_food(colormap.colors[trail_index], food_alpha);
+        fprintf(file, "%.6f %.6f %.6f\n", color.r / 255.0, color.g / 255.0, color.b / 255.0);
+    }
+    if (fclose(file) == EOF) {
+        perror("Error");
+        return -1;
+    }
+    return 0;
 }
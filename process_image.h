@@ -2,6 +2,8 @@
 #define PROCESS_IMAGE_H
 
 #include <stdint.h>
+
+#include "tune.h"
 /*
  * Stores an rgb value as a triplet of bytes
  */
@@ -37,11 +39,36 @@ struct ColorMap load_colormap(const char *filename);
 void destroy_colormap(struct ColorMap colormap);
 
 /**
- * Returns an image where every pixel is colored according to the corresponding value and given color_map
+ * Fills image so every pixel is colored according to the corresponding value and given color_map
  *
- * Image must be in row-major order. The minval is assumed to be 0. Pixels
+ * Image must be in row-major order and hold width * height pixels. The minval is assumed to be 0. Pixels
  * below 0 are treated as 0 and pixels above maxval are treated as maxval.
  */
-struct Color* color_image(double *trail_grid, double *food_grid, int width, int height, struct ColorMap colormap, double trail_maxval, double food_maxval);
+void color_image(struct Color *image, double *trail_grid, double *food_grid, int width, int height, struct ColorMap colormap, double trail_maxval, double food_maxval, int nthreads, struct PhaseTuning tuning);
+
+/**
+ * Fills image so every pixel is a 16 bit index that write_colormap_lut
+ * maps to the same color color_image would give, up to the food being
+ * quantized to 64 levels.
+ *
+ * The high 10 bits hold the colormap index and the low 6 bits the food value.
+ */
+void index_image(uint16_t *image, double *trail_grid, double *food_grid, int width, int height, struct ColorMap colormap, double trail_maxval, double food_maxval, int nthreads, struct PhaseTuning tuning);
+
+/**
+ * The bodies of color_image and index_image, called by every thread of a team
+ * so the frame can be filled in the simulation's parallel region. They end
+ * without a barrier.
+ */
+void color_image_team(struct Color *image, double *trail_grid, double *food_grid, int width, int height, struct ColorMap colormap, double trail_maxval, double food_maxval, struct PhaseTuning tuning);
+void index_image_team(uint16_t *image, double *trail_grid, double *food_grid, int width, int height, struct ColorMap colormap, double trail_maxval, double food_maxval, struct PhaseTuning tuning);
+
+/**
+ * Writes a 1D LUT in the .cube format with an entry for every 16 bit index
+ * produced by index_image. The colormap can have at most 1024 colors.
+ *
+ * Returns -1 and may print an error on failure, 0 otherwise.
+ */
+int write_colormap_lut(const char *filename, struct ColorMap colormap);
 
 #endif
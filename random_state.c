@@ -0,0 +1,85 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "random_state.h"
+#include "util.h"
+
+struct ColorMap sample_colormap(int length) {
+    struct ColorMap colormap;
+    colormap.length = length;
+    colormap.colors = malloc_or_die(colormap.length * sizeof(*colormap.colors));
+    for (int i = 0; i < colormap.length; i++) {
+        colormap.colors[i].r = i / 4;
+        colormap.colors[i].g = (i * 7) % 256;
+        colormap.colors[i].b = 255 - i / 4;
+    }
+    return colormap;
+}
+
+struct Behavior sample_behavior(double trail_max) {
+    struct Behavior behavior;
+    behavior.step_size = 1;
+    behavior.trail_deposit_rate = 5;
+    behavior.jitter_angle = 0.2;
+    behavior.rotation_angle = 0.5;
+    behavior.sensor_length = 9;
+    behavior.sensor_angle = 0.5;
+    behavior.dispersion_rate = 0.1;
+    behavior.evaporation_rate_exp = 0.01;
+    behavior.evaporation_rate_lin = 0.1;
+    behavior.trail_max = trail_max;
+    return behavior;
+}
+
+double *random_grid(int width, int height, double max, unsigned int *seedp) {
+    double *grid = malloc_or_die(width * height * sizeof(*grid));
+    for (int i = 0; i < width * height; i++) {
+        grid[i] = randd(0, max, seedp);
+    }
+    return grid;
+}
+
+double *random_food(int width, int height, double max, unsigned int *seedp) {
+    double *grid = malloc_or_die(width * height * sizeof(*grid));
+    for (int i = 0; i < width * height; i++) {
+        grid[i] = randint(0, 9, seedp) == 0 ? randd(0, max, seedp) : 0;
+    }
+    return grid;
+}
+
+struct Agent *random_agents(int nagents, int width, int height, unsigned int *seedp) {
+    struct Agent *agents = malloc_or_die(nagents * sizeof(*agents));
+    for (int i = 0; i < nagents; i++) {
+        agents[i].x = randd(0, width - 0.01, seedp);
+        agents[i].y = randd(0, height - 0.01, seedp);
+        agents[i].direction = randd(0, 2 * M_PI, seedp);
+        agents[i].energy = 1;
+    }
+    return agents;
+}
+
+struct RandomState random_state_create(int width, int height, int nagents, double trail_max, double food_max, unsigned int seed, int nseeds) {
+    struct RandomState state;
+    unsigned int state_seed = seed;
+    state.trail_map = (struct Map) {random_grid(width, height, trail_max, &state_seed), width, height, NULL};
+    state.trail_map.scratch = malloc_or_die(width * height * sizeof(*state.trail_map.scratch));
+    state.food_map = (struct Map) {random_food(width, height, food_max, &state_seed), width, height, NULL};
+    state.agents = random_agents(nagents, width, height, &state_seed);
+    state.nagents = nagents;
+    state.agent_pos_freq = malloc_or_die(width * height * sizeof(*state.agent_pos_freq));
+    state.seeds = malloc_or_die(nseeds * sizeof(*state.seeds));
+    state.nseeds = nseeds;
+    for (int i = 0; i < nseeds; i++) {
+        state.seeds[i] = seed ^ (i + 1);
+    }
+    return state;
+}
+
+void random_state_destroy(struct RandomState *state) {
+    free(state->seeds);
+    free(state->agent_pos_freq);
+    free(state->agents);
+    free(state->food_map.grid);
+    free(state->trail_map.scratch);
+    free(state->trail_map.grid);
+}
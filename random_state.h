@@ -0,0 +1,65 @@
+#ifndef RANDOM_STATE_H
+#define RANDOM_STATE_H
+
+#include "process_image.h"
+#include "slimemold_simulation.h"
+
+/** @file
+ * @brief Random simulation states for the checks and the overhead measurement.
+ *
+ * The same arguments always give the same state, so two states created alike
+ * can be stepped by two implementations and compared.
+ */
+
+/// Everything a step reads and writes
+struct RandomState {
+    /// Trail map with its scratch grid
+    struct Map trail_map;
+    struct Map food_map;
+    struct Agent *agents;
+    int nagents;
+    int *agent_pos_freq;
+    /// One seed for each of nseeds threads
+    unsigned int *seeds;
+    int nseeds;
+};
+
+/**
+ * Returns a smooth colormap where neighboring indices have different colors.
+ * Free it with destroy_colormap.
+ */
+struct ColorMap sample_colormap(int length);
+
+/**
+ * Returns typical behavior parameters. The results hardly depend on them.
+ */
+struct Behavior sample_behavior(double trail_max);
+
+/**
+ * Returns a grid of values uniform in [0, max).
+ */
+double *random_grid(int width, int height, double max, unsigned int *seedp);
+
+/**
+ * Returns a grid that is mostly 0 with some cells in [0, max), like the
+ * gaussians of the real food map.
+ */
+double *random_food(int width, int height, double max, unsigned int *seedp);
+
+/**
+ * Returns live agents at random positions and directions.
+ */
+struct Agent *random_agents(int nagents, int width, int height, unsigned int *seedp);
+
+/**
+ * Creates a random trail, food map and agents, with seeds[i] = seed ^ (i + 1).
+ * @param nseeds Number of seeds, at least the threads that step the state
+ */
+struct RandomState random_state_create(int width, int height, int nagents, double trail_max, double food_max, unsigned int seed, int nseeds);
+
+/**
+ * Frees everything random_state_create allocated.
+ */
+void random_state_destroy(struct RandomState *state);
+
+#endif
@@ -0,0 +1,237 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reference_simulation.h"
+#include "util.h"
+
+// helpers are static so they don't clash with the optimized simulation
+
+#define EPSILON 0.001
+// max number of agents that be in once cell before randomization
+#define AGENTS_PER_CELL_THRESHOLD 1
+#define COVERAGE_FRACTION 0.01
+#define FOOD_VISIBILITY 0.5
+#define INDEX_FOOD_BITS 6
+#define FOOD_LEVELS_MAX ((1 << INDEX_FOOD_BITS) - 1)
+
+static int reference_randint(int min, int max, unsigned int *seedp) {
+    return min + (rand_r(seedp) % (max - min + 1));
+}
+
+static double reference_randd(double min, double max, unsigned int *seedp) {
+    return min + (((double)rand_r(seedp))/RAND_MAX) * (max - min);
+}
+
+static double next_x(double x, double distance, double direction) {
+    return x + distance * cos(direction);
+}
+
+static double next_y(double y, double distance, double direction) {
+    return y + distance * sin(direction);
+}
+
+static int get_index(int width, double x, double y) {
+    return (int) y * width + (int) x;
+}
+
+static double bound(double n, double min, double max) {
+    return fmax(min, fmin(max, n));
+}
+
+void reference_disperse_grid(double *grid, double *next_grid, int width, int height, double dispersion_rate) {
+    for (int row = 0; row < height; row++) {
+        for (int col = 0; col < width; col++) {
+            int index = row * width + col;
+            if (row == 0 || row == height - 1 || col == 0 || col == width - 1) {
+                next_grid[index] = 0;
+                continue;
+            }
+            next_grid[index] = grid[row * width + (col - 1)];
+            next_grid[index] += grid[row * width + (col + 1)];
+            next_grid[index] += grid[(row - 1) * width + col];
+            next_grid[index] += grid[(row + 1) * width + col];
+            next_grid[index] *= dispersion_rate;
+            next_grid[index] += (1 - 4 * dispersion_rate) * grid[row * width + col];
+        }
+    }
+}
+
+void reference_evaporate_trail(struct Map trail_map, double evaporation_rate_exp, double evaporation_rate_lin) {
+    for (int i = 0; i < trail_map.width * trail_map.height; i++) {
+        trail_map.grid[i] = fmax(trail_map.grid[i] * (1 - evaporation_rate_exp) - evaporation_rate_lin, 0);
+    }
+}
+
+void reference_record_position(int *agent_pos_freq, int width, int height, struct Agent *agents, int nagents) {
+    memset(agent_pos_freq, 0, width * height * sizeof(*agent_pos_freq));
+    for (int i = 0; i < nagents; i++) {
+        agent_pos_freq[get_index(width, agents[i].x, agents[i].y)]++;
+    }
+}
+
+static double attraction(double trail, double food) {
+    return trail + food;
+}
+
+static void turn_uptrail(struct Agent *agent, double rotation_angle, double sensor_length, double sensor_angle, struct Map trail_map, struct Map food_map, unsigned int *seedp) {
+    int order[3] = {0, -1, 1};
+    if (reference_randint(0, 1, seedp) == 1) {
+        order[1] = 1;
+        order[2] = -1;
+    }
+    double max_direction = agent->direction;
+    double max_trail = -INFINITY;
+    for (int i = 0; i < 3; i++) {
+        double dir = agent->direction + (order[i] * sensor_angle);
+        double ahead_x = next_x(agent->x, sensor_length, dir);
+        double ahead_y = next_y(agent->y, sensor_length, dir);
+        if (ahead_x < EPSILON || ahead_x > trail_map.width - EPSILON || ahead_y < EPSILON || ahead_y > trail_map.height - EPSILON) {
+            continue;
+        }
+        int index = get_index(trail_map.width, ahead_x, ahead_y);
+        double attr = attraction(trail_map.grid[index], food_map.grid[index]);
+        if (attr > max_trail) {
+            max_trail = attr;
+            max_direction = agent->direction + (order[i] * rotation_angle);
+        }
+    }
+    agent->direction = max_direction;
+}
+
+static void set_direction(struct Agent *agent, struct Behavior behavior, struct Map trail_map, struct Map food_map, int *agent_pos_freq, unsigned int *seedp) {
+    int freq = agent_pos_freq[get_index(trail_map.width, agent->x, agent->y)];
+    if (freq > AGENTS_PER_CELL_THRESHOLD && reference_randint(1, freq, seedp) > AGENTS_PER_CELL_THRESHOLD) {
+        agent->direction = reference_randd(-M_PI, M_PI, seedp);
+    } else {
+        turn_uptrail(agent, behavior.rotation_angle, behavior.sensor_length, behavior.sensor_angle, trail_map, food_map, seedp);
+        agent->direction += reference_randd(-behavior.jitter_angle, behavior.jitter_angle, seedp);
+    }
+}
+
+static void move(struct Agent *agent, struct Behavior behavior, struct Map trail_map) {
+    double sensor_x = bound(next_x(agent->x, behavior.sensor_length, agent->direction), EPSILON, trail_map.width - EPSILON);
+    double sensor_y = bound(next_y(agent->y, behavior.sensor_length, agent->direction), EPSILON, trail_map.height - EPSILON);
+    double trail_strength = trail_map.grid[get_index(trail_map.width, sensor_x, sensor_y)];
+    double cur_speed = behavior.step_size * (0.2 + 0.8 * (trail_strength / behavior.trail_max));
+
+    // wrap around the edges
+    double new_x = fmod(next_x(agent->x, cur_speed, agent->direction) + trail_map.width, trail_map.width);
+    double new_y = fmod(next_y(agent->y, cur_speed, agent->direction) + trail_map.height, trail_map.height);
+    if (new_x > trail_map.width - EPSILON) {
+        new_x = trail_map.width - EPSILON;
+    }
+    // y is bounded by the width like the original simulation
+    if (new_y > trail_map.width - EPSILON) {
+        new_y = trail_map.width - EPSILON;
+    }
+    agent->x = new_x;
+    agent->y = new_y;
+}
+
+void reference_move_agents(struct Map trail_map, struct Map food_map, struct Agent *agents, int nagents, struct Behavior behavior, int *agent_pos_freq, unsigned int *seedp) {
+    reference_record_position(agent_pos_freq, trail_map.width, trail_map.height, agents, nagents);
+    for (int i = 0; i < nagents; i++) {
+        set_direction(&agents[i], behavior, trail_map, food_map, agent_pos_freq, seedp);
+        move(&agents[i], behavior, trail_map);
+    }
+}
+
+void reference_deposit_trail(struct Map trail_map, struct Agent *agents, int nagents, double trail_deposit_rate, double trail_max) {
+    for (int i = 0; i < nagents; i++) {
+        int index = get_index(trail_map.width, agents[i].x, agents[i].y);
+        trail_map.grid[index] = fmin(trail_max, trail_map.grid[index] + trail_deposit_rate);
+    }
+}
+
+void reference_simulate_step(struct Map *p_trail_map, struct Map food_map, struct Agent *agents, int nagents, struct Behavior behavior, int *agent_pos_freq, unsigned int *seedp) {
+    double *next_grid = malloc_or_die(p_trail_map->width * p_trail_map->height * sizeof(*next_grid));
+    reference_disperse_grid(p_trail_map->grid, next_grid, p_trail_map->width, p_trail_map->height, behavior.dispersion_rate);
+    free(p_trail_map->grid);
+    p_trail_map->grid = next_grid;
+    reference_evaporate_trail(*p_trail_map, behavior.evaporation_rate_exp, behavior.evaporation_rate_lin);
+    reference_move_agents(*p_trail_map, food_map, agents, nagents, behavior, agent_pos_freq, seedp);
+    reference_deposit_trail(*p_trail_map, agents, nagents, behavior.trail_deposit_rate, behavior.trail_max);
+}
+
+void reference_update_population(struct Agent *agents, int nagents, struct Map food_map, double food_maxval, int *agent_pos_freq, struct PopulationBehavior behavior, unsigned int *seedp, struct Agent *spawns, int *p_nspawns, int spawn_capacity) {
+    for (int i = 0; i < nagents; i++) {
+        struct Agent *agent = &agents[i];
+        if (agent->energy <= 0) {
+            continue;
+        }
+        int index = get_index(food_map.width, agent->x, agent->y);
+        agent->energy += behavior.food_energy * food_map.grid[index] / food_maxval - behavior.metabolism;
+        int freq = agent_pos_freq[index];
+        if (freq > behavior.crowd_threshold
+                && reference_randd(0, 1, seedp) < behavior.crowd_death_rate * (freq - behavior.crowd_threshold) / behavior.crowd_threshold) {
+            agent->energy = 0;
+        }
+        if (agent->energy > 0 && agent->energy >= behavior.spawn_energy && *p_nspawns < spawn_capacity) {
+            agent->energy /= 2;
+            spawns[*p_nspawns] = *agent;
+            spawns[*p_nspawns].direction = reference_randd(0, 2 * M_PI, seedp);
+            (*p_nspawns)++;
+        }
+    }
+}
+
+void reference_step_stats(struct Map trail_map, int *agent_pos_freq, int nagents, double trail_max, struct StepStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < trail_map.width * trail_map.height; i++) {
+        double value = trail_map.grid[i];
+        stats->trail_mass += value;
+        if (value > COVERAGE_FRACTION * trail_max) {
+            stats->coverage++;
+        }
+        int bin = (int) (value / trail_max * TRAIL_HISTOGRAM_BINS);
+        if (bin >= TRAIL_HISTOGRAM_BINS) {
+            bin = TRAIL_HISTOGRAM_BINS - 1;
+        }
+        stats->trail_histogram[bin]++;
+
+        int n = agent_pos_freq[i];
+        stats->live_agents += n;
+        if (n > 0) {
+            double p = (double) n / nagents;
+            stats->occupancy_entropy -= p * log(p);
+        }
+        if (n > stats->max_cell_load) {
+            stats->max_cell_load = n;
+        }
+    }
+}
+
+static int colormap_index(double trail_val, struct ColorMap colormap, double trail_maxval) {
+    int trail_index = (int) trail_val * (colormap.length / trail_maxval);
+    if (trail_index == colormap.length) {
+        trail_index--;
+    }
+    return trail_index;
+}
+
+struct Color* reference_color_image(double *trail_grid, double *food_grid, int width, int height, struct ColorMap colormap, double trail_maxval, double food_maxval) {
+    struct Color *image = malloc_or_die(width * height * sizeof(*image));
+    for (int i = 0; i < width * height; i++) {
+        double trail_val = fmax(fmin(trail_grid[i], trail_maxval), 0);
+        double food_val = fmax(fmin(food_grid[i], food_maxval), 0);
+        struct Color trail_color = colormap.colors[colormap_index(trail_val, colormap, trail_maxval)];
+        double food_alpha = FOOD_VISIBILITY * food_val / food_maxval;
+        image[i].r = trail_color.r * (1 - food_alpha);
+        image[i].g = trail_color.g * (1 - food_alpha) + 255 * food_alpha;
+        image[i].b = trail_color.b * (1 - food_alpha);
+    }
+    return image;
+}
+
+uint16_t* reference_index_image(double *trail_grid, double *food_grid, int width, int height, struct ColorMap colormap, double trail_maxval, double food_maxval) {
+    uint16_t *image = malloc_or_die(width * height * sizeof(*image));
+    for (int i = 0; i < width * height; i++) {
+        double trail_val = fmax(fmin(trail_grid[i], trail_maxval), 0);
+        double food_val = fmax(fmin(food_grid[i], food_maxval), 0);
+        int food_level = (int) round(food_val / food_maxval * FOOD_LEVELS_MAX);
+        image[i] = (uint16_t) ((colormap_index(trail_val, colormap, trail_maxval) << INDEX_FOOD_BITS) | food_level);
+    }
+    return image;
+}
@@ -0,0 +1,75 @@
+#ifndef REFERENCE_SIMULATION_H
+#define REFERENCE_SIMULATION_H
+
+#include <stdint.h>
+
+#include "population.h"
+#include "process_image.h"
+#include "slimemold_simulation.h"
+
+/** @file
+ * @brief Frozen serial reference of every phase of the simulation.
+ *
+ * These are plain copies of the kernels as they were before any optimization.
+ * Don't change them when optimizing the simulation, they define the behavior
+ * verify_kernels checks the optimized kernels against.
+ */
+
+/**
+ * Disperses grid into next_grid with a FTCS heat equation step and a boundary of 0.
+ */
+void reference_disperse_grid(double *grid, double *next_grid, int width, int height, double dispersion_rate);
+
+/**
+ * Decays every cell exponentially then linearly, never going below 0.
+ */
+void reference_evaporate_trail(struct Map trail_map, double evaporation_rate_exp, double evaporation_rate_lin);
+
+/**
+ * Stores the number of agents in every cell.
+ */
+void reference_record_position(int *agent_pos_freq, int width, int height, struct Agent *agents, int nagents);
+
+/**
+ * Records the agent positions, then turns and moves every agent in order
+ * drawing all random numbers from the single seed.
+ *
+ * Matches move_agents run on one thread exactly.
+ */
+void reference_move_agents(struct Map trail_map, struct Map food_map, struct Agent *agents, int nagents, struct Behavior behavior, int *agent_pos_freq, unsigned int *seedp);
+
+/**
+ * Adds trail_deposit_rate under every agent, capped at trail_max.
+ */
+void reference_deposit_trail(struct Map trail_map, struct Agent *agents, int nagents, double trail_deposit_rate, double trail_max);
+
+/**
+ * Runs every phase of one step in the same order as simulate_step.
+ *
+ * Warning: replaces p_trail_map->grid with a newly allocated grid.
+ */
+void reference_simulate_step(struct Map *p_trail_map, struct Map food_map, struct Agent *agents, int nagents, struct Behavior behavior, int *agent_pos_freq, unsigned int *seedp);
+
+/**
+ * Feeds, kills and splits every live agent in order like update_population
+ * on one thread. New agents are appended to spawns while *p_nspawns is below
+ * spawn_capacity.
+ */
+void reference_update_population(struct Agent *agents, int nagents, struct Map food_map, double food_maxval, int *agent_pos_freq, struct PopulationBehavior behavior, unsigned int *seedp, struct Agent *spawns, int *p_nspawns, int spawn_capacity);
+
+/**
+ * Fills in stats with separate passes over the trail and the agent counts.
+ */
+void reference_step_stats(struct Map trail_map, int *agent_pos_freq, int nagents, double trail_max, struct StepStats *stats);
+
+/**
+ * Colors every pixel like color_image.
+ */
+struct Color* reference_color_image(double *trail_grid, double *food_grid, int width, int height, struct ColorMap colormap, double trail_maxval, double food_maxval);
+
+/**
+ * Packs every pixel into a 16 bit index like index_image.
+ */
+uint16_t* reference_index_image(double *trail_grid, double *food_grid, int width, int height, struct ColorMap colormap, double trail_maxval, double food_maxval);
+
+#endif
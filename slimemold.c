@@ -2,6 +2,7 @@
 #include <limits.h>
 #include <math.h>
 #include <omp.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,9 +11,13 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "autotune.h"
 #include "encode_video.h"
+#include "iteration.h"
+#include "population.h"
 #include "process_image.h"
 #include "slimemold_simulation.h"
+#include "step_overhead.h"
 #include "util.h"
 
 #define FFMPEG_LOG_LEVEL "info"
@@ -37,6 +42,45 @@
 // how many cycles between changing the food
 #define FOOD_CHANGE_PERIOD 1800
 
+// send 16 bit colormap indices to FFmpeg instead of rgb frames
+#define INDEXED_FRAMES 1
+#define LUT_TEMPLATE "/tmp/slimemold-lut-XXXXXX.cube"
+// length of the ".cube" suffix of the template
+#define LUT_SUFFIX_LEN 5
+
+// number of FFmpeg processes encoding segments at the same time, 1 streams
+// every frame to a single process
+#define ENCODER_WORKERS 1
+#define ENCODING_PRESET FAST
+// frames per segment when there are multiple workers
+#define SEGMENT_FRAMES 240
+
+// time the OpenMP settings of each phase at startup, or load them from the
+// profile written to the current directory by an earlier tuned run
+#define AUTOTUNE 0
+#define TUNE_PROFILE "slimemold-tune.txt"
+
+// let agents spawn near food and die when starved or crowded
+#define POPULATION_DYNAMICS 0
+// the population can grow up to this many times nagents
+#define POPULATION_MAX_FACTOR 10
+// steps between packing the live agents together
+#define COMPACTION_PERIOD 8
+#define INITIAL_ENERGY 1.0
+#define FOOD_ENERGY 0.2
+#define METABOLISM 0.01
+#define SPAWN_ENERGY 2.0
+#define CROWD_THRESHOLD 4
+#define CROWD_DEATH_RATE 0.05
+// agents only gain energy from food, so without any they would all starve.
+// With N_FOOD 0 the population gets this many food sources instead
+#define POPULATION_N_FOOD 8
+#define FOOD_SOURCES (POPULATION_DYNAMICS && N_FOOD == 0 ? POPULATION_N_FOOD : N_FOOD)
+
+// write statistics of the network every step to the output file name plus this suffix
+#define ANALYTICS 0
+#define ANALYTICS_SUFFIX ".stats.csv"
+
 struct Coord {
     int x, y;
 };
@@ -61,7 +105,8 @@ double parse_double(char *str, char *val, double min, double max) {
     return n;
 }
 
-void write_image (struct Color *image, int width, int height, int fd) {
+// returns -1 if writing to the pipe failed, 0 otherwise
+int write_image (struct Color *image, int width, int height, int fd) {
     ssize_t written;
     // write the header
     dprintf(fd, "P6\n%d %d 255\n", width, height);
@@ -69,7 +114,7 @@ void write_image (struct Color *image, int width, int height, int fd) {
     written = write(fd, image, width * height * sizeof(*image));
     if (written != width * height * (long int) sizeof(*image)) {
         fprintf(stderr, "Error writing to pipe\n");
-        exit(1);
+        return -1;
     }
     // to debug, write out each frame as an image, need to pass in index i
     /*char name[256];
@@ -82,12 +127,50 @@ void write_image (struct Color *image, int width, int height, int fd) {
     fprintf(fp, "P6\n%d %d 255\n", width, height);
     fwrite(image, sizeof(*image), width * height, fp);
     fclose(fp);*/
+    return 0;
 }
 
-void prepare_and_write_image (double* trail_map, double* food_map, int width, int height, struct ColorMap colormap, int fd) {
-    struct Color *prepared_image = color_image(trail_map, food_map, width, height, colormap, TRAIL_MAX, FOOD_FACTOR * TRAIL_MAX);
-    write_image(prepared_image, width, height, fd);
-    free(prepared_image);
+// returns -1 if writing to the pipe failed, 0 otherwise
+int write_indexed_image (uint16_t *image, int width, int height, int fd) {
+    ssize_t written;
+    // raw frames have no header
+    written = write(fd, image, width * height * sizeof(*image));
+    if (written != width * height * (long int) sizeof(*image)) {
+        fprintf(stderr, "Error writing to pipe\n");
+        return -1;
+    }
+    return 0;
+}
+
+// writes frame to fd if spipe is NULL, otherwise hands a frame taken from the
+// segmented pipe's pool to the segment workers, which return it once it is
+// encoded
+// returns -1 if writing to the pipe or the segment worker failed, 0 otherwise
+int write_frame (void *frame, int width, int height, int fd, struct SegmentedPipe *spipe) {
+    if (spipe != NULL) {
+        return write_segment_frame(spipe, frame);
+    }
+    if (INDEXED_FRAMES) {
+        return write_indexed_image(frame, width, height, fd);
+    }
+    return write_image(frame, width, height, fd);
+}
+
+void write_stats_header(FILE *file) {
+    fprintf(file, "step,trail_mass,coverage,occupancy_entropy,max_cell_load,live_agents");
+    for (int i = 0; i < TRAIL_HISTOGRAM_BINS; i++) {
+        fprintf(file, ",trail_bin_%d", i);
+    }
+    fprintf(file, "\n");
+}
+
+// coverage is written as a fraction of the cells
+void write_stats(FILE *file, int step, struct StepStats stats, long ncells) {
+    fprintf(file, "%d,%.9g,%.6f,%.6f,%d,%d", step, stats.trail_mass, (double) stats.coverage / ncells, stats.occupancy_entropy, stats.max_cell_load, stats.live_agents);
+    for (int i = 0; i < TRAIL_HISTOGRAM_BINS; i++) {
+        fprintf(file, ",%ld", stats.trail_histogram[i]);
+    }
+    fprintf(file, "\n");
 }
 
 void intialize_agents(struct Agent *agents, int nagents, int width, int height, unsigned int* seedp) {
@@ -96,6 +179,7 @@ void intialize_agents(struct Agent *agents, int nagents, int width, int height,
         agents[i].x = randd(0, width, seedp);
         agents[i].y = randd(0, height, seedp);
         agents[i].direction = randd(0, 2 * M_PI, seedp);
+        agents[i].energy = INITIAL_ENERGY;
 
         //agents[i].x = 0.5 * width;
         //agents[i].y = 0.5 * height;
@@ -150,11 +234,17 @@ void fill_food_map(struct Map food_map, struct Coord *foods, int nfood) {
 }
 
 int main(int argc, char *argv[]) {
+    // compare the single region step and iteration with a region per phase
+    if (argc == 2 && strcmp(argv[1], "--step-overhead") == 0) {
+        measure_step_overhead();
+        return 0;
+    }
     // Parse the command line arguments
     if (argc != 16) {
         fprintf(stderr, "usage: %s width height fps seconds nagents step_size "
                 "trail_deposit_rate jitter_angle rotation_angle sensor_length sensor_angle dispersion_rate "
-                "evaporation_rate_exp evaporation_rate_lin output_file\n", argv[0]);
+                "evaporation_rate_exp evaporation_rate_lin output_file\n"
+                "       %s --step-overhead\n", argv[0], argv[0]);
         exit(1);
     }
     struct Behavior behavior;
@@ -197,50 +287,154 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    // allocate space for the grid
+    // the grids, agent counts and agents live as long as the simulation, so
+    // they share one arena backed by huge pages
+    size_t ncells = (size_t) width * height;
+    int capacity = POPULATION_DYNAMICS ? (int) fmin((double) nagents * POPULATION_MAX_FACTOR, INT_MAX) : nagents;
+    // a single encoder is fed from one frame, segment workers cycle through a
+    // pool of frames that can fill all their queues
+    size_t frame_size = ncells * (INDEXED_FRAMES ? sizeof(uint16_t) : sizeof(struct Color));
+    size_t frame_block = ENCODER_WORKERS > 1 ? segmented_pipe_size(frame_size, ENCODER_WORKERS, SEGMENT_FRAMES) : arena_block_size(frame_size);
+    struct Arena arena = arena_create(3 * arena_block_size(ncells * sizeof(double))
+            + arena_block_size(ncells * sizeof(int)) + agent_pool_size(capacity, omp_get_max_threads(), POPULATION_DYNAMICS) + frame_block);
+    printf("Allocated %zu MB backed by %s\n\n", arena.size >> 20, arena.backing);
+
+    // allocate space for the grid, arena memory starts out zeroed
     struct Map trail_map;
     trail_map.width = width;
     trail_map.height = height;
-    trail_map.grid = malloc_or_die(trail_map.width * trail_map.height * sizeof(*(trail_map.grid)));
-    // zero out memory
-    memset(trail_map.grid, 0, trail_map.width * trail_map.height * sizeof(*(trail_map.grid)));
+    trail_map.grid = arena_alloc(&arena, ncells * sizeof(*(trail_map.grid)));
+    trail_map.scratch = arena_alloc(&arena, ncells * sizeof(*(trail_map.scratch)));
 
     // intialize agents
-    struct Agent *agents = malloc_or_die(nagents * sizeof(*agents));
-    intialize_agents(agents, nagents, trail_map.width, trail_map.height, &seeds[0]);
+    struct AgentPool pool = agent_pool_create(&arena, capacity, omp_get_max_threads(), POPULATION_DYNAMICS);
+    pool.count = nagents;
+    intialize_agents(pool.agents, pool.count, trail_map.width, trail_map.height, &seeds[0]);
+    struct IterationSettings settings;
+    settings.behavior = behavior;
+    settings.population.food_energy = FOOD_ENERGY;
+    settings.population.metabolism = METABOLISM;
+    settings.population.spawn_energy = SPAWN_ENERGY;
+    settings.population.crowd_threshold = CROWD_THRESHOLD;
+    settings.population.crowd_death_rate = CROWD_DEATH_RATE;
+    settings.dynamic = POPULATION_DYNAMICS;
+    settings.colormap = colormap;
+    settings.food_maxval = FOOD_FACTOR * TRAIL_MAX;
+    settings.indexed = INDEXED_FRAMES;
     // record the number of agents at each point
-    int *agent_pos_freq = malloc_or_die(trail_map.width * trail_map.height* sizeof(*agent_pos_freq));
+    int *agent_pos_freq = arena_alloc(&arena, ncells * sizeof(*agent_pos_freq));
+    void *frame = ENCODER_WORKERS > 1 ? NULL : arena_alloc(&arena, frame_size);
 
     // initialize food
-    struct Coord *foods = malloc_or_die(N_FOOD * sizeof(*foods));
+    struct Coord *foods = malloc_or_die(FOOD_SOURCES * sizeof(*foods));
     struct Map food_map;
     food_map.width = trail_map.width;
     food_map.height = trail_map.height;
-    food_map.grid = malloc_or_die(food_map.width * food_map.height * sizeof(*food_map.grid));
-    initialize_foods(foods, N_FOOD, food_map.width, food_map.height, &seeds[0]);
-    fill_food_map(food_map, foods, N_FOOD);
+    food_map.grid = arena_alloc(&arena, ncells * sizeof(*food_map.grid));
+    food_map.scratch = NULL;
+    initialize_foods(foods, FOOD_SOURCES, food_map.width, food_map.height, &seeds[0]);
+    fill_food_map(food_map, foods, FOOD_SOURCES);
+
+    struct Tuning tuning = default_tuning();
+    if (AUTOTUNE) {
+        tuning = autotune(TUNE_PROFILE, trail_map, food_map, pool, seeds, settings, ANALYTICS);
+    }
+
+    // opened before the LUT is written so failing here leaves nothing in /tmp
+    FILE *stats_file = NULL;
+    if (ANALYTICS) {
+        char stats_filename[4096];
+        snprintf(stats_filename, sizeof(stats_filename), "%s" ANALYTICS_SUFFIX, filename);
+        stats_file = fopen(stats_filename, "w");
+        if (stats_file == NULL) {
+            perror("Error");
+            exit(1);
+        }
+        write_stats_header(stats_file);
+    }
+
+    // write the colormap as a LUT so FFmpeg can color the indexed frames. It
+    // is removed again on every failure from here on
+    char lut_filename[] = LUT_TEMPLATE;
+    if (INDEXED_FRAMES) {
+        int lutfd = mkstemps(lut_filename, LUT_SUFFIX_LEN);
+        if (lutfd == -1) {
+            perror("Error");
+            exit(1);
+        }
+        close(lutfd);
+        if (write_colormap_lut(lut_filename, colormap) == -1) {
+            unlink(lut_filename);
+            exit(1);
+        }
+    }
 
+    // an encoder that exits early makes writes fail with EPIPE instead of
+    // killing the process, so the failure can be reported
+    signal(SIGPIPE, SIG_IGN);
     //initiate FFmpeg
-    int outfd;
+    int outfd = -1;
     pid_t pid;
-    if (open_pipe(fps, filename, FAST, &outfd, &pid) == -1) {
+    struct SegmentedPipe spipe;
+    if (ENCODER_WORKERS > 1) {
+        if (open_segmented_pipe(fps, width, height, filename, ENCODING_PRESET, INDEXED_FRAMES ? lut_filename : NULL, ENCODER_WORKERS, SEGMENT_FRAMES, &arena, &spipe) == -1) {
+            perror("Error");
+            if (INDEXED_FRAMES) {
+                unlink(lut_filename);
+            }
+            exit(1);
+        }
+    } else if (open_pipe(fps, width, height, filename, ENCODING_PRESET, INDEXED_FRAMES ? lut_filename : NULL, &outfd, &pid) == -1) {
         perror("Error");
+        if (INDEXED_FRAMES) {
+            unlink(lut_filename);
+        }
         exit(1);
     }
 
+    struct StepStats stats;
+    int status = 0;
+
     // main simulation loop
     for (int i = 0; i < seconds * fps; i++) {
         //printf("----Cycle %d----\n", i);
-        if (N_FOOD != 0 && i % FOOD_CHANGE_PERIOD == 0) {
-            change_food(foods, N_FOOD, food_map.width, food_map.height, &seeds[0]);
-            fill_food_map(food_map, foods, N_FOOD);
+        if (FOOD_SOURCES != 0 && i % FOOD_CHANGE_PERIOD == 0) {
+            change_food(foods, FOOD_SOURCES, food_map.width, food_map.height, &seeds[0]);
+            fill_food_map(food_map, foods, FOOD_SOURCES);
+        }
+        // a segment worker may still be encoding the last frame, so each
+        // iteration fills a free one from the pool
+        void *step_frame = ENCODER_WORKERS > 1 ? take_segment_frame(&spipe) : frame;
+        simulate_iteration(&trail_map, food_map, &pool, agent_pos_freq, seeds, settings, (i + 1) % COMPACTION_PERIOD == 0, step_frame, tuning, ANALYTICS ? &stats : NULL);
+        if (ANALYTICS) {
+            write_stats(stats_file, i, stats, ncells);
+        }
+        // a failed segment is reported when the pipe is closed, the LUT is
+        // still removed after a failed write
+        if (write_frame(step_frame, trail_map.width, trail_map.height, outfd, ENCODER_WORKERS > 1 ? &spipe : NULL) == -1) {
+            status = 1;
+            break;
         }
-        simulate_step(&trail_map, food_map, agents, nagents, behavior, agent_pos_freq, seeds);
-        prepare_and_write_image(trail_map.grid, food_map.grid, trail_map.width, trail_map.height, colormap, outfd);
     }
 
-    free(trail_map.grid);
-    free(agents);
+    if (ANALYTICS) {
+        fclose(stats_file);
+    }
+    // the segment workers still read frames from the arena until they stop
+    if (ENCODER_WORKERS > 1) {
+        if (close_segmented_pipe(&spipe) == -1) {
+            status = 1;
+        }
+    } else if (close_pipe(outfd, pid) == -1) {
+        perror("Error encoding the video");
+        status = 1;
+    }
+    arena_destroy(&arena);
+    free(foods);
+    free(seeds);
     destroy_colormap(colormap);
-    close_pipe(outfd, pid);
+    if (INDEXED_FRAMES) {
+        unlink(lut_filename);
+    }
+    return status;
 }
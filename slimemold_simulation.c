@@ -6,6 +6,7 @@
 #include <string.h>
 
 #include "slimemold_simulation.h"
+#include "tune.h"
 #include "util.h"
 
 #define EPSILON 0.001
@@ -13,6 +14,8 @@
 #define SCATTER_BUFFER M_PI/4
 // max number of agents that be in once cell before randomization
 #define AGENTS_PER_CELL_THRESHOLD 1
+// cells with more trail than this fraction of trail_max count as covered
+#define COVERAGE_FRACTION 0.01
 
 // get the next x after moving distance units in direction
 double next_x(double x, double distance, double direction) {
@@ -33,26 +36,97 @@ double bound(double n, double min, double max) {
     return fmax(min, fmin(max, n));
 }
 
-// Given some space to store every cell in widthxheight, stores the number of agents there
-void record_position(int *agent_pos_freq, int width, int height, struct Agent *agents, int nagents) {
-    memset(agent_pos_freq, 0, width * height * sizeof(*agent_pos_freq));
-    #pragma omp parallel for
+// n log n, with 0 log 0 = 0
+double n_log_n(int n) {
+    return n == 0 ? 0 : n * log(n);
+}
+
+// Counts this thread's share of the agents into agent_pos_freq, which must
+// already be cleared. Called by every thread of a team. Dead agents are only
+// looked for if skip_dead is set. If stats is not NULL,
+// adds the thread's share of the occupancy measures to it, keeping the sum of
+// n log n in occupancy_entropy until finish_occupancy_entropy.
+void record_position_team(int *agent_pos_freq, int width, struct Agent *agents, int nagents, int skip_dead, struct PhaseTuning tuning, struct StepStats *stats) {
+    apply_schedule(tuning);
+    if (stats == NULL) {
+        #pragma omp for schedule(runtime) nowait
+        for (int i = 0; i < nagents; i++) {
+            if (skip_dead && agents[i].energy <= 0) {
+                continue;
+            }
+            int index = get_index(width, agents[i].x, agents[i].y);
+            int oldval = agent_pos_freq[index];
+            while (!atomic_compare_exchange_weak(&agent_pos_freq[index], &oldval, oldval + 1));
+        }
+        return;
+    }
+    // the entropy is log(nagents) - sum(n log n) / nagents over the cell counts n.
+    // Every increment knows the count it replaced, so the sum is built up from
+    // the change of each increment without another pass over the cells
+    double sum_n_log_n = 0;
+    int max_cell_load = 0;
+    int nalive = 0;
+    #pragma omp for schedule(runtime) nowait
     for (int i = 0; i < nagents; i++) {
+        if (skip_dead && agents[i].energy <= 0) {
+            continue;
+        }
+        nalive++;
         int index = get_index(width, agents[i].x, agents[i].y);
         int oldval = agent_pos_freq[index];
         while (!atomic_compare_exchange_weak(&agent_pos_freq[index], &oldval, oldval + 1));
+        sum_n_log_n += n_log_n(oldval + 1) - n_log_n(oldval);
+        if (oldval + 1 > max_cell_load) {
+            max_cell_load = oldval + 1;
+        }
+    }
+    #pragma omp critical(record_stats)
+    {
+        stats->occupancy_entropy += sum_n_log_n;
+        stats->live_agents += nalive;
+        if (max_cell_load > stats->max_cell_load) {
+            stats->max_cell_load = max_cell_load;
+        }
+    }
+}
+
+// turns the sum of n log n left by record_position_team into the entropy
+void finish_occupancy_entropy(struct StepStats *stats) {
+    double sum_n_log_n = stats->occupancy_entropy;
+    stats->occupancy_entropy = stats->live_agents > 0 ? log(stats->live_agents) - sum_n_log_n / stats->live_agents : 0;
+}
+
+// Given some space to store every cell in widthxheight, stores the number of agents there
+void record_position(int *agent_pos_freq, int width, int height, struct Agent *agents, int nagents, int skip_dead, struct PhaseTuning tuning, struct StepStats *stats) {
+    memset(agent_pos_freq, 0, width * height * sizeof(*agent_pos_freq));
+    if (stats != NULL) {
+        stats->occupancy_entropy = 0;
+        stats->max_cell_load = 0;
+        stats->live_agents = 0;
+    }
+    #pragma omp parallel
+    record_position_team(agent_pos_freq, width, agents, nagents, skip_dead, tuning, stats);
+    if (stats != NULL) {
+        finish_occupancy_entropy(stats);
     }
 }
 
-void disperse_grid(double *grid, double *next_grid, int width, int height, double dispersion_rate) {
+// Disperses grid into next_grid, called by every thread of a team
+void disperse_grid_team(double *grid, double *next_grid, int width, int height, double dispersion_rate, struct PhaseTuning tuning) {
+    // the center cells are split into column tiles so a thread walks down a
+    // strip narrow enough to keep the rows above and below in cache
+    int tile_width = tuning.tile_width > 0 ? tuning.tile_width : width - 2;
+    int ntiles = (width - 2 + tile_width - 1) / tile_width;
+    apply_schedule(tuning);
     // handles the center cells using a FTCS scheme.
     // finds the sum of the difference between the current and adjacent cells
     // and moves the current value by that difference scaled by the dispersion_rate
-    #pragma omp parallel
-    {
-        #pragma omp for nowait
+    #pragma omp for collapse(2) schedule(runtime) nowait
+    for (int tile = 0; tile < ntiles; tile++) {
         for (int row = 1; row < height - 1; row++) {
-            for (int col = 1; col < width - 1; col++) {
+            int start_col = 1 + tile * tile_width;
+            int end_col = start_col + tile_width < width - 1 ? start_col + tile_width : width - 1;
+            for (int col = start_col; col < end_col; col++) {
                 int index = row * width + col;
                 // sum the four adjacent cell
                 next_grid[index] = grid[row * width + (col - 1)];
@@ -65,47 +139,55 @@ void disperse_grid(double *grid, double *next_grid, int width, int height, doubl
                 next_grid[index] += (1 - 4 * dispersion_rate) * grid[row * width + col];
             }
         }
-        // handles boundary condition
-        // it is organized like this to make it easier to change the boundary condition
-        // top row
-        #pragma omp for nowait
-        for (int col = 1; col < width - 1; col++) {
-            next_grid[0 * width + col] = 0;
-        }
-        // bottom row
-        #pragma omp for nowait
-        for (int col = 1; col < width - 1; col++) {
-            next_grid[(height - 1) * width + col] = 0;
-        }
-        // left column
-        #pragma omp for nowait
-        for (int row = 1; row < height - 1; row++) {
-            next_grid[row * width + 0] = 0;
-        }
-        // right column
-        #pragma omp for nowait
-        for (int row = 1; row < height - 1; row++) {
-            next_grid[row * width + (width - 1)] = 0;
-        }
     }
-    // top left corner
-    next_grid[0 * width + 0] = 0;
-    // top right corner
-    next_grid[0 * width + (width - 1)] = 0;
-    // bottom left corner
-    next_grid[(height - 1) * width + 0] = 0;
-    // bottom right corner
-    next_grid[(height - 1)  * width + (width - 1)] = 0;
+    // handles boundary condition
+    // it is organized like this to make it easier to change the boundary condition
+    // top row
+    #pragma omp for nowait
+    for (int col = 1; col < width - 1; col++) {
+        next_grid[0 * width + col] = 0;
+    }
+    // bottom row
+    #pragma omp for nowait
+    for (int col = 1; col < width - 1; col++) {
+        next_grid[(height - 1) * width + col] = 0;
+    }
+    // left column
+    #pragma omp for nowait
+    for (int row = 1; row < height - 1; row++) {
+        next_grid[row * width + 0] = 0;
+    }
+    // right column
+    #pragma omp for nowait
+    for (int row = 1; row < height - 1; row++) {
+        next_grid[row * width + (width - 1)] = 0;
+    }
+    // the corners are written by one thread
+    #pragma omp single nowait
+    {
+        // top left corner
+        next_grid[0 * width + 0] = 0;
+        // top right corner
+        next_grid[0 * width + (width - 1)] = 0;
+        // bottom left corner
+        next_grid[(height - 1) * width + 0] = 0;
+        // bottom right corner
+        next_grid[(height - 1)  * width + (width - 1)] = 0;
+    }
+}
+
+void disperse_grid(double *grid, double *next_grid, int width, int height, double dispersion_rate, struct PhaseTuning tuning) {
+    #pragma omp parallel
+    disperse_grid_team(grid, next_grid, width, height, dispersion_rate, tuning);
 }
 
 // uses a heat equation with prescribed boundary conditions value = 0
-// warning: changes the map.grid pointer
-void disperse_trail(struct Map *p_trail_map, double dispersion_rate) {
-    // allocates a new map
-    double *next_grid = malloc_or_die(p_trail_map->width * p_trail_map->height * sizeof(*next_grid));
-    disperse_grid(p_trail_map->grid, next_grid, p_trail_map->width, p_trail_map->height, dispersion_rate);
+// warning: swaps the map.grid and map.scratch pointers
+void disperse_trail(struct Map *p_trail_map, double dispersion_rate, struct PhaseTuning tuning) {
+    disperse_grid(p_trail_map->grid, p_trail_map->scratch, p_trail_map->width, p_trail_map->height, dispersion_rate, tuning);
     // switch next_map with the current grid
-    free(p_trail_map->grid);
+    double *next_grid = p_trail_map->scratch;
+    p_trail_map->scratch = p_trail_map->grid;
     p_trail_map->grid = next_grid;
 }
 
@@ -210,13 +292,51 @@ void move_and_check_wall_collision (struct Agent *agent, double step_size, doubl
     agent->y = new_y;
 }
 
-void evaporate_trail (struct Map trail_map, double evaporation_rate_exp, double evaporation_rate_lin) {
-    #pragma omp parallel for
+// Evaporates this thread's share of the trail, called by every thread of a
+// team. If stats is not NULL, adds the thread's share of the trail measures
+void evaporate_trail_team(struct Map trail_map, double evaporation_rate_exp, double evaporation_rate_lin, double trail_max, struct PhaseTuning tuning, struct StepStats *stats) {
+    apply_schedule(tuning);
+    if (stats == NULL) {
+        #pragma omp for schedule(runtime) nowait
+        for (int i = 0; i < trail_map.width * trail_map.height; i++) {
+            trail_map.grid[i] = fmax(trail_map.grid[i] * (1 - evaporation_rate_exp) - evaporation_rate_lin, 0);
+        }
+        return;
+    }
+    // measure the trail while each cell is in a register anyway
+    double trail_mass = 0;
+    long coverage = 0;
+    long histogram[TRAIL_HISTOGRAM_BINS] = {0};
+    double coverage_threshold = COVERAGE_FRACTION * trail_max;
+    #pragma omp for schedule(runtime) nowait
     for (int i = 0; i < trail_map.width * trail_map.height; i++) {
-        trail_map.grid[i] = fmax(trail_map.grid[i] * (1 - evaporation_rate_exp) - evaporation_rate_lin, 0);
+        double value = fmax(trail_map.grid[i] * (1 - evaporation_rate_exp) - evaporation_rate_lin, 0);
+        trail_map.grid[i] = value;
+        trail_mass += value;
+        coverage += value > coverage_threshold;
+        int bin = (int) (value / trail_max * TRAIL_HISTOGRAM_BINS);
+        histogram[bin < TRAIL_HISTOGRAM_BINS ? bin : TRAIL_HISTOGRAM_BINS - 1]++;
+    }
+    #pragma omp critical(evaporate_stats)
+    {
+        stats->trail_mass += trail_mass;
+        stats->coverage += coverage;
+        for (int i = 0; i < TRAIL_HISTOGRAM_BINS; i++) {
+            stats->trail_histogram[i] += histogram[i];
+        }
     }
 }
 
+void evaporate_trail (struct Map trail_map, double evaporation_rate_exp, double evaporation_rate_lin, double trail_max, struct PhaseTuning tuning, struct StepStats *stats) {
+    if (stats != NULL) {
+        stats->trail_mass = 0;
+        stats->coverage = 0;
+        memset(stats->trail_histogram, 0, sizeof(stats->trail_histogram));
+    }
+    #pragma omp parallel
+    evaporate_trail_team(trail_map, evaporation_rate_exp, evaporation_rate_lin, trail_max, tuning, stats);
+}
+
 void set_direction(struct Agent *agent, double rotation_angle, double sensor_length, double sensor_angle, double jitter_angle, struct Map trail_map, struct Map food_map, int *agent_pos_freq, unsigned int *seedp) {
     int index = get_index(trail_map.width, agent->x, agent->y);
     int freq = agent_pos_freq[index];
@@ -229,35 +349,97 @@ void set_direction(struct Agent *agent, double rotation_angle, double sensor_len
     }
 }
 
-void move_agents(struct Map trail_map, struct Map food_map, struct Agent *agents, int nagents, struct Behavior behavior, int *agent_pos_freq, unsigned int *seeds) {
-    record_position(agent_pos_freq, trail_map.width, trail_map.height, agents, nagents);
-    #pragma omp parallel
-    {
-        // copies the value to avoid false sharing
-        unsigned int seed = seeds[omp_get_thread_num()];
-        #pragma omp for
-        for (int i = 0; i < nagents; i++) {
-            struct Agent *agent = &agents[i];
-            set_direction(agent, behavior.rotation_angle, behavior.sensor_length, behavior.sensor_angle, behavior.jitter_angle, trail_map, food_map, agent_pos_freq, &seed);
-            move_and_check_wall_collision(agent, behavior.step_size, behavior.sensor_length, behavior.trail_max, trail_map, &seed);
+// Moves this thread's share of the agents, called by every thread of a team
+// after the positions are recorded
+void move_agents_team(struct Map trail_map, struct Map food_map, struct Agent *agents, int nagents, int skip_dead, struct Behavior behavior, int *agent_pos_freq, unsigned int *seeds, struct PhaseTuning tuning) {
+    apply_schedule(tuning);
+    // copies the value to avoid false sharing
+    unsigned int seed = seeds[omp_get_thread_num()];
+    #pragma omp for schedule(runtime) nowait
+    for (int i = 0; i < nagents; i++) {
+        struct Agent *agent = &agents[i];
+        if (skip_dead && agent->energy <= 0) {
+            continue;
         }
-        seeds[omp_get_thread_num()] = seed;
+        set_direction(agent, behavior.rotation_angle, behavior.sensor_length, behavior.sensor_angle, behavior.jitter_angle, trail_map, food_map, agent_pos_freq, &seed);
+        move_and_check_wall_collision(agent, behavior.step_size, behavior.sensor_length, behavior.trail_max, trail_map, &seed);
     }
+    seeds[omp_get_thread_num()] = seed;
 }
 
-void deposit_trail(struct Map trail_map, struct Agent *agents, int nagents, double trail_deposit_rate, double trail_max) {
-    #pragma omp parallel for
+void move_agents(struct Map trail_map, struct Map food_map, struct Agent *agents, int nagents, int skip_dead, struct Behavior behavior, int *agent_pos_freq, unsigned int *seeds, struct PhaseTuning tuning, struct StepStats *stats) {
+    record_position(agent_pos_freq, trail_map.width, trail_map.height, agents, nagents, skip_dead, tuning, stats);
+    #pragma omp parallel
+    move_agents_team(trail_map, food_map, agents, nagents, skip_dead, behavior, agent_pos_freq, seeds, tuning);
+}
+
+// Deposits the trail of this thread's share of the agents, called by every
+// thread of a team
+void deposit_trail_team(struct Map trail_map, struct Agent *agents, int nagents, int skip_dead, double trail_deposit_rate, double trail_max, struct PhaseTuning tuning) {
+    apply_schedule(tuning);
+    #pragma omp for schedule(runtime) nowait
     for (int i = 0; i < nagents; i++) {
+        if (skip_dead && agents[i].energy <= 0) {
+            continue;
+        }
         int index = get_index(trail_map.width, agents[i].x, agents[i].y);
         double oldval = trail_map.grid[index];
         while (!atomic_compare_exchange_weak(&trail_map.grid[index], &oldval, fmin(trail_max, oldval + trail_deposit_rate)));
     }
 }
 
-void simulate_step(struct Map *p_trail_map, struct Map food_map, struct Agent *agents, int nagents, struct Behavior behavior, int *agent_pos_freq, unsigned int *seeds) {
-    disperse_trail(p_trail_map, behavior.dispersion_rate);
-    evaporate_trail(*p_trail_map, behavior.evaporation_rate_exp, behavior.evaporation_rate_lin);
+void deposit_trail(struct Map trail_map, struct Agent *agents, int nagents, int skip_dead, double trail_deposit_rate, double trail_max, struct PhaseTuning tuning) {
+    #pragma omp parallel
+    deposit_trail_team(trail_map, agents, nagents, skip_dead, trail_deposit_rate, trail_max, tuning);
+}
 
-    move_agents(*p_trail_map, food_map, agents, nagents, behavior, agent_pos_freq, seeds);
-    deposit_trail(*p_trail_map, agents, nagents, behavior.trail_deposit_rate, behavior.trail_max);
+void simulate_step_split(struct Map *p_trail_map, struct Map food_map, struct Agent *agents, int nagents, int skip_dead, struct Behavior behavior, int *agent_pos_freq, unsigned int *seeds, struct Tuning tuning, struct StepStats *stats) {
+    disperse_trail(p_trail_map, behavior.dispersion_rate, tuning.stencil);
+    evaporate_trail(*p_trail_map, behavior.evaporation_rate_exp, behavior.evaporation_rate_lin, behavior.trail_max, tuning.stencil, stats);
+
+    move_agents(*p_trail_map, food_map, agents, nagents, skip_dead, behavior, agent_pos_freq, seeds, tuning.agents, stats);
+    deposit_trail(*p_trail_map, agents, nagents, skip_dead, behavior.trail_deposit_rate, behavior.trail_max, tuning.agents);
+}
+
+void simulate_step_team(struct Map trail_map, struct Map next_map, struct Map food_map, struct Agent *agents, int nagents, int skip_dead, struct Behavior behavior, int *agent_pos_freq, unsigned int *seeds, struct Tuning tuning, struct StepStats *stats) {
+    int width = trail_map.width;
+    int height = trail_map.height;
+    // nothing reads the counts until after the next barrier
+    #pragma omp for nowait
+    for (int i = 0; i < width * height; i++) {
+        agent_pos_freq[i] = 0;
+    }
+    disperse_grid_team(trail_map.grid, next_map.grid, width, height, behavior.dispersion_rate, tuning.stencil);
+    // evaporation reads cells dispersed by other threads and recording
+    // needs every count cleared
+    #pragma omp barrier
+    // the two phases touch different data, so they share the next barrier
+    evaporate_trail_team(next_map, behavior.evaporation_rate_exp, behavior.evaporation_rate_lin, behavior.trail_max, tuning.stencil, stats);
+    record_position_team(agent_pos_freq, width, agents, nagents, skip_dead, tuning.agents, stats);
+    // agents sense the evaporated trail and the counts of every cell
+    #pragma omp barrier
+    move_agents_team(next_map, food_map, agents, nagents, skip_dead, behavior, agent_pos_freq, seeds, tuning.agents);
+    // depositing changes the trail other agents may still be sensing
+    #pragma omp barrier
+    deposit_trail_team(next_map, agents, nagents, skip_dead, behavior.trail_deposit_rate, behavior.trail_max, tuning.agents);
+}
+
+struct Map step_next_map(struct Map trail_map) {
+    struct Map next_map = trail_map;
+    next_map.grid = trail_map.scratch;
+    next_map.scratch = trail_map.grid;
+    return next_map;
+}
+
+void simulate_step(struct Map *p_trail_map, struct Map food_map, struct Agent *agents, int nagents, int skip_dead, struct Behavior behavior, int *agent_pos_freq, unsigned int *seeds, struct Tuning tuning, struct StepStats *stats) {
+    struct Map next_map = step_next_map(*p_trail_map);
+    if (stats != NULL) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    #pragma omp parallel num_threads(tuned_threads(tuning.step_threads))
+    simulate_step_team(*p_trail_map, next_map, food_map, agents, nagents, skip_dead, behavior, agent_pos_freq, seeds, tuning, stats);
+    if (stats != NULL) {
+        finish_occupancy_entropy(stats);
+    }
+    *p_trail_map = next_map;
 }
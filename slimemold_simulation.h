@@ -1,16 +1,24 @@
 #ifndef SLIMEMOLD_SIMULATION_H
 #define SLIMEMOLD_SIMULATION_H
 
+#include "tune.h"
+
 struct Agent {
     double direction;
     double x;
     double y;
+    // agents with no energy left are dead and skipped until they are compacted
+    // away. Only looked at when the population can change
+    double energy;
 };
 
 struct Map {
     double *grid;
     int width;
     int height;
+    // grid of the same size the trail is dispersed into, then swapped with grid.
+    // Only needed for the trail map
+    double *scratch;
 };
 
 // Parameters that control the simulation
@@ -27,5 +35,72 @@ struct Behavior {
     double trail_max;
 };
 
-void simulate_step(struct Map *p_trail_map, struct Map food_map, struct Agent *agents, int nagents, struct Behavior behavior, int *agent_pos_freq, unsigned int *seeds);
+#define TRAIL_HISTOGRAM_BINS 16
+
+// Measures of the network computed while the phases already touch the data
+struct StepStats {
+    // sum of the trail after evaporation
+    double trail_mass;
+    // number of cells with more trail than COVERAGE_FRACTION * trail_max
+    long coverage;
+    // number of cells in each of TRAIL_HISTOGRAM_BINS equal bins from 0 to trail_max
+    long trail_histogram[TRAIL_HISTOGRAM_BINS];
+    // entropy in nats of the distribution of agents over cells
+    double occupancy_entropy;
+    // most agents in one cell
+    int max_cell_load;
+    // agents that are alive
+    int live_agents;
+};
+
+/*
+ * The phases of simulate_step, each in its own parallel region with the
+ * default number of threads, exposed so they can be checked against the
+ * reference implementation.
+ */
+void disperse_grid(double *grid, double *next_grid, int width, int height, double dispersion_rate, struct PhaseTuning tuning);
+void evaporate_trail(struct Map trail_map, double evaporation_rate_exp, double evaporation_rate_lin, double trail_max, struct PhaseTuning tuning, struct StepStats *stats);
+void record_position(int *agent_pos_freq, int width, int height, struct Agent *agents, int nagents, int skip_dead, struct PhaseTuning tuning, struct StepStats *stats);
+void move_agents(struct Map trail_map, struct Map food_map, struct Agent *agents, int nagents, int skip_dead, struct Behavior behavior, int *agent_pos_freq, unsigned int *seeds, struct PhaseTuning tuning, struct StepStats *stats);
+void deposit_trail(struct Map trail_map, struct Agent *agents, int nagents, int skip_dead, double trail_deposit_rate, double trail_max, struct PhaseTuning tuning);
+
+/*
+ * Advances the simulation by one step. If stats is not NULL, it is filled in
+ * by the evaporation and position recording phases. Dead agents are only
+ * skipped if skip_dead is set, otherwise every agent must be alive, which
+ * saves testing each one.
+ *
+ * Every phase runs in a single parallel region, with a barrier only where a
+ * phase reads what other threads wrote in the phase before. The team has
+ * tuning.step_threads threads.
+ */
+void simulate_step(struct Map *p_trail_map, struct Map food_map, struct Agent *agents, int nagents, int skip_dead, struct Behavior behavior, int *agent_pos_freq, unsigned int *seeds, struct Tuning tuning, struct StepStats *stats);
+
+/*
+ * The body of simulate_step, called by every thread of a team so a caller can
+ * run more phases in the same parallel region. Disperses trail_map into
+ * next_map, which is the trail afterwards, and ends without a barrier after
+ * depositing. stats must be zeroed before the region and finished with
+ * finish_occupancy_entropy after it.
+ */
+void simulate_step_team(struct Map trail_map, struct Map next_map, struct Map food_map, struct Agent *agents, int nagents, int skip_dead, struct Behavior behavior, int *agent_pos_freq, unsigned int *seeds, struct Tuning tuning, struct StepStats *stats);
+
+/*
+ * Returns the map the trail is dispersed into, trail_map with grid and
+ * scratch swapped.
+ */
+struct Map step_next_map(struct Map trail_map);
+
+/*
+ * Turns the sum of n log n left in stats->occupancy_entropy by the step into
+ * the entropy.
+ */
+void finish_occupancy_entropy(struct StepStats *stats);
+
+/*
+ * Advances the simulation by one step like simulate_step, but opens a
+ * parallel region with the default number of threads for every phase. Kept
+ * to measure the overhead the single region saves.
+ */
+void simulate_step_split(struct Map *p_trail_map, struct Map food_map, struct Agent *agents, int nagents, int skip_dead, struct Behavior behavior, int *agent_pos_freq, unsigned int *seeds, struct Tuning tuning, struct StepStats *stats);
 #endif
@@ -0,0 +1,115 @@
+#include <math.h>
+#include <omp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "iteration.h"
+#include "population.h"
+#include "random_state.h"
+#include "slimemold_simulation.h"
+#include "step_overhead.h"
+#include "tune.h"
+
+#define TRAIL_MAX 1000
+#define FOOD_MAX (2 * TRAIL_MAX)
+#define WARMUP_STEPS 10
+#define COLORMAP_LENGTH 1024
+// iterations between compactions, as in the real run
+#define COMPACTION_PERIOD 8
+// both structures are timed this many times, alternating, and the fastest counts
+#define OVERHEAD_REPEATS 5
+
+struct OverheadCase {
+    const char *name;
+    int width;
+    int height;
+    int nagents;
+    // steps per timing, fewer on larger grids to keep the run short
+    int nsteps;
+};
+
+struct OverheadCase overhead_cases[] = {
+    {"small", 64, 64, 1000, 1000},
+    {"medium", 256, 256, 20000, 100},
+    {"large", 1024, 1024, 200000, 10},
+};
+
+typedef void (*StepFunction)(struct Map *p_trail_map, struct Map food_map, struct Agent *agents, int nagents, int skip_dead, struct Behavior behavior, int *agent_pos_freq, unsigned int *seeds, struct Tuning tuning, struct StepStats *stats);
+typedef void (*IterationFunction)(struct Map *p_trail_map, struct Map food_map, struct AgentPool *pool, int *agent_pos_freq, unsigned int *seeds, struct IterationSettings settings, int compact, void *frame, struct Tuning tuning, struct StepStats *stats);
+
+// returns the mean time of one step in seconds
+double time_steps(StepFunction step, int nsteps, struct Map *p_trail_map, struct Map food_map, struct Agent *agents, int nagents, struct Behavior behavior, int *agent_pos_freq, unsigned int *seeds, struct StepStats *stats) {
+    double start = omp_get_wtime();
+    for (int i = 0; i < nsteps; i++) {
+        step(p_trail_map, food_map, agents, nagents, 0, behavior, agent_pos_freq, seeds, default_tuning(), stats);
+    }
+    return (omp_get_wtime() - start) / nsteps;
+}
+
+// returns the mean time of one iteration in seconds
+double time_iterations(IterationFunction iteration, int niterations, struct RandomState *state, struct AgentPool *pool, struct IterationSettings settings, void *frame, struct StepStats *stats) {
+    double start = omp_get_wtime();
+    for (int i = 0; i < niterations; i++) {
+        iteration(&state->trail_map, state->food_map, pool, state->agent_pos_freq, state->seeds, settings, (i + 1) % COMPACTION_PERIOD == 0, frame, default_tuning(), stats);
+    }
+    return (omp_get_wtime() - start) / niterations;
+}
+
+void print_overhead(struct OverheadCase overhead_case, const char *unit, double split, double single) {
+    printf("%s %dx%d, %d agents: %.1f us per %s with a region per phase, %.1f us with one region, %.1f us (%.1f%%) saved\n",
+            overhead_case.name, overhead_case.width, overhead_case.height, overhead_case.nagents, split * 1e6, unit, single * 1e6,
+            (split - single) * 1e6, 100 * (split - single) / split);
+}
+
+void measure_case(struct OverheadCase overhead_case) {
+    struct Behavior behavior = sample_behavior(TRAIL_MAX);
+    struct RandomState state = random_state_create(overhead_case.width, overhead_case.height, overhead_case.nagents, TRAIL_MAX, FOOD_MAX, 1, omp_get_max_threads());
+    // the statistics are off by default in the real run
+    struct StepStats *stats = NULL;
+
+    // let trails form so both structures are timed on a developed network
+    time_steps(simulate_step, WARMUP_STEPS, &state.trail_map, state.food_map, state.agents, state.nagents, behavior, state.agent_pos_freq, state.seeds, stats);
+    double split = INFINITY;
+    double single = INFINITY;
+    for (int i = 0; i < OVERHEAD_REPEATS; i++) {
+        split = fmin(split, time_steps(simulate_step_split, overhead_case.nsteps, &state.trail_map, state.food_map, state.agents, state.nagents, behavior, state.agent_pos_freq, state.seeds, stats));
+        single = fmin(single, time_steps(simulate_step, overhead_case.nsteps, &state.trail_map, state.food_map, state.agents, state.nagents, behavior, state.agent_pos_freq, state.seeds, stats));
+    }
+    print_overhead(overhead_case, "step", split, single);
+
+    // whole iterations of a dynamic population with indexed frames. No agent
+    // dies or splits, so both structures do the same work every iteration
+    struct IterationSettings settings;
+    settings.behavior = behavior;
+    settings.population = (struct PopulationBehavior) {0, 0, INFINITY, 1, 0};
+    settings.dynamic = 1;
+    settings.colormap = sample_colormap(COLORMAP_LENGTH);
+    settings.food_maxval = FOOD_MAX;
+    settings.indexed = 1;
+    struct Arena arena = arena_create(agent_pool_size(state.nagents, omp_get_max_threads(), 1)
+            + arena_block_size((size_t) overhead_case.width * overhead_case.height * sizeof(uint16_t)));
+    struct AgentPool pool = agent_pool_create(&arena, state.nagents, omp_get_max_threads(), 1);
+    memcpy(pool.agents, state.agents, state.nagents * sizeof(*state.agents));
+    pool.count = state.nagents;
+    uint16_t *frame = arena_alloc(&arena, (size_t) overhead_case.width * overhead_case.height * sizeof(*frame));
+
+    split = INFINITY;
+    single = INFINITY;
+    for (int i = 0; i < OVERHEAD_REPEATS; i++) {
+        split = fmin(split, time_iterations(simulate_iteration_split, overhead_case.nsteps, &state, &pool, settings, frame, stats));
+        single = fmin(single, time_iterations(simulate_iteration, overhead_case.nsteps, &state, &pool, settings, frame, stats));
+    }
+    print_overhead(overhead_case, "iteration", split, single);
+
+    arena_destroy(&arena);
+    destroy_colormap(settings.colormap);
+    random_state_destroy(&state);
+}
+
+void measure_step_overhead(void) {
+    printf("Timing steps and iterations on %d threads\n", omp_get_max_threads());
+    for (size_t i = 0; i < sizeof(overhead_cases) / sizeof(*overhead_cases); i++) {
+        measure_case(overhead_cases[i]);
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef STEP_OVERHEAD_H
+#define STEP_OVERHEAD_H
+
+/** @file
+ * @brief Measures how much a step and an iteration save by running in a
+ * single parallel region.
+ *
+ * Times simulate_step against simulate_step_split, and simulate_iteration
+ * against simulate_iteration_split, which open a region for every phase as
+ * the main loop used to, on a few problem sizes. The difference is the fork,
+ * join and barrier overhead of the extra regions, which matters most on small
+ * grids.
+ */
+
+/**
+ * Prints the time per step and per iteration of both structures for every
+ * problem size.
+ */
+void measure_step_overhead(void);
+
+#endif
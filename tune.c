@@ -0,0 +1,17 @@
+#include <omp.h>
+
+#include "tune.h"
+
+struct Tuning default_tuning(void) {
+    struct PhaseTuning phase = {omp_sched_static, 0, 0};
+    struct Tuning tuning = {0, phase, phase, phase};
+    return tuning;
+}
+
+int tuned_threads(int nthreads) {
+    return nthreads > 0 ? nthreads : omp_get_max_threads();
+}
+
+void apply_schedule(struct PhaseTuning tuning) {
+    omp_set_schedule(tuning.schedule, tuning.chunk);
+}
@@ -0,0 +1,57 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <omp.h>
+
+/** @file
+ * @brief Picks the OpenMP settings of each phase by timing them at startup.
+ *
+ * The fastest schedule, thread count and tile size depend on the grid size,
+ * the number of agents and the caches of the host, so each phase is timed
+ * with a few candidates on the real problem size. Every phase of an
+ * iteration of the main loop runs on one team, so they share one thread
+ * count. The result is saved in a
+ * profile file keyed by the host, the problem shape, the frame format and
+ * whether statistics are computed and agents can die, so later runs of the
+ * same shape start tuned.
+ */
+
+/// How the loops of one phase are split between threads
+struct PhaseTuning {
+    omp_sched_t schedule;
+    /// Chunk size of the schedule, 0 uses the schedule's default
+    int chunk;
+    /// Columns processed per tile by the stencil, 0 processes whole rows
+    int tile_width;
+};
+
+/// Settings of every phase of the simulation
+struct Tuning {
+    /// Threads of the team that runs every phase of an iteration, 0 uses the
+    /// OpenMP default
+    int step_threads;
+    /// Dispersion and evaporation of the trail
+    struct PhaseTuning stencil;
+    /// Recording, moving and depositing of the agents
+    struct PhaseTuning agents;
+    /// Coloring of the frames
+    struct PhaseTuning colorize;
+};
+
+/**
+ * Returns the settings used without tuning: the default number of threads,
+ * static schedule and whole rows.
+ */
+struct Tuning default_tuning(void);
+
+/**
+ * Returns the number of threads to run on for a tuned count, which may be 0.
+ */
+int tuned_threads(int nthreads);
+
+/**
+ * Sets the schedule used by the schedule(runtime) loops of a phase.
+ */
+void apply_schedule(struct PhaseTuning tuning);
+
+#endif
@@ -1,9 +1,15 @@
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #include "util.h"
 
+// size of a huge page on x86-64 and most other platforms
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
 void* malloc_or_die(size_t size) {
     void *ptr = malloc(size);
     if(ptr == NULL) {
@@ -13,6 +19,87 @@ void* malloc_or_die(size_t size) {
     return ptr;
 }
 
+size_t arena_block_size(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
+
+// maps size bytes starting on a huge page boundary and asks for transparent
+// huge pages, returns NULL on failure
+char* map_huge_aligned(size_t size) {
+    // map an extra huge page so there is room to align, then trim the ends
+    size_t padded = size + HUGE_PAGE_SIZE;
+    char *raw = mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+    char *base = (char *) (((uintptr_t) raw + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+    if (base != raw) {
+        munmap(raw, base - raw);
+    }
+    if (raw + padded != base + size) {
+        munmap(base + size, raw + padded - (base + size));
+    }
+#ifdef MADV_HUGEPAGE
+    // only a hint, the arena works with normal pages if it is refused
+    madvise(base, size, MADV_HUGEPAGE);
+#endif
+    return base;
+}
+
+struct Arena arena_create(size_t size) {
+    struct Arena arena;
+    // whole huge pages, so the last one can be backed by a huge page too
+    arena.size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    arena.used = 0;
+    arena.mapped = 1;
+    arena.base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    // fails unless huge pages were reserved by the administrator
+    arena.base = mmap(NULL, arena.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (arena.base != MAP_FAILED) {
+        arena.backing = "huge pages";
+        return arena;
+    }
+    arena.base = map_huge_aligned(arena.size);
+    if (arena.base != NULL) {
+        arena.backing = "transparent huge pages if available";
+        return arena;
+    }
+    arena.mapped = 0;
+    arena.base = aligned_alloc(ARENA_ALIGNMENT, arena.size);
+    if (arena.base == NULL) {
+        perror("arena allocation failed");
+        exit(1);
+    }
+    // mapped memory is already zero
+    memset(arena.base, 0, arena.size);
+    arena.backing = "normal pages";
+    return arena;
+}
+
+void* arena_alloc(struct Arena *arena, size_t size) {
+    size_t block_size = arena_block_size(size);
+    if (block_size > arena->size - arena->used) {
+        fprintf(stderr, "arena allocation failed: %zu bytes requested, %zu left\n", size, arena->size - arena->used);
+        exit(1);
+    }
+    void *ptr = arena->base + arena->used;
+    arena->used += block_size;
+    return ptr;
+}
+
+void arena_destroy(struct Arena *arena) {
+    if (arena->mapped) {
+        munmap(arena->base, arena->size);
+    } else {
+        free(arena->base);
+    }
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
 int randint(int min, int max, unsigned int *seedp) {
     return min + (rand_r(seedp) % (max - min + 1));
 }
@@ -8,6 +8,48 @@
  */
 void* malloc_or_die(size_t size);
 
+/// Alignment of every block handed out by an arena, a cache line
+#define ARENA_ALIGNMENT 64
+
+/**
+ * A single large allocation that blocks are carved out of and freed together.
+ * Meant for the big buffers that live as long as the simulation, where huge
+ * pages cut down TLB misses on random accesses.
+ */
+struct Arena {
+    char *base;
+    size_t size;
+    size_t used;
+    /// 1 if base was mapped with mmap, 0 if it came from aligned_alloc
+    int mapped;
+    /// Describes the pages backing the arena
+    const char *backing;
+};
+
+/**
+ * Returns the space a block of size bytes takes up in an arena, for sizing it.
+ */
+size_t arena_block_size(size_t size);
+
+/**
+ * Creates an arena of at least size bytes, exits on failure.
+ *
+ * Tries explicit huge pages first, then a mapping aligned to a huge page with
+ * transparent huge pages requested, then plain aligned memory.
+ */
+struct Arena arena_create(size_t size);
+
+/**
+ * Returns a zeroed block of size bytes aligned to ARENA_ALIGNMENT, exits if
+ * the arena is full.
+ */
+void* arena_alloc(struct Arena *arena, size_t size);
+
+/**
+ * Frees every block of the arena at once.
+ */
+void arena_destroy(struct Arena *arena);
+
 /**
  * Generates a random int between min and max inclusive.
  *
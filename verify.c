@@ -0,0 +1,603 @@
+#include <math.h>
+#include <omp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iteration.h"
+#include "population.h"
+#include "process_image.h"
+#include "random_state.h"
+#include "reference_simulation.h"
+#include "slimemold_simulation.h"
+#include "tune.h"
+#include "util.h"
+#include "verify.h"
+
+#define TRAIL_MAX 1000
+#define FOOD_MAX (2 * TRAIL_MAX)
+#define COLORMAP_LENGTH 1024
+
+// grid kernels may reorder floating point operations a little
+#define MAX_ULP 4
+// steps compared exactly when running on one thread
+#define EXACT_STEPS 10
+// the fused statistics sum in a different order than the reference
+#define MAX_STATS_ERROR 1e-9
+// tile width of the extra stencil check, narrow so the grids have several tiles
+#define TILED_WIDTH 7
+// the statistical comparison runs on several threads
+#define STAT_THREADS 4
+#define STAT_STEPS 30
+// the iteration check lets the population grow up to this many times the agents
+#define ITERATION_CAPACITY_FACTOR 2
+#define ITERATION_COMPACTION_PERIOD 8
+// max relative difference in trail mass and coverage
+#define MAX_RELATIVE_ERROR 0.02
+// max total variation distance between occupancy histograms
+#define MAX_HISTOGRAM_DISTANCE 0.02
+// cells with more agents go in the last bucket
+#define HISTOGRAM_BUCKETS 8
+// a cell is covered if its trail is above this
+#define COVERAGE_THRESHOLD 1.0
+// every this many agents one is dead in the dead agent checks
+#define DEAD_STRIDE 3
+
+struct Scenario {
+    const char *name;
+    int width;
+    int height;
+    int nagents;
+    unsigned int seed;
+};
+
+struct Scenario scenarios[] = {
+    {"smallest", 3, 3, 5, 1},
+    {"square", 64, 64, 2000, 2},
+    {"wide", 257, 31, 8000, 3},
+    {"tall", 31, 129, 3000, 4},
+    {"crowded", 128, 96, 60000, 5},
+};
+
+// the same scenario always gives the same state, so an actual and an expected
+// state created from it start alike
+struct RandomState create_state(struct Scenario scenario, int nseeds) {
+    return random_state_create(scenario.width, scenario.height, scenario.nagents, TRAIL_MAX, FOOD_MAX, scenario.seed, nseeds);
+}
+
+// maps the bits of a double to an integer that is ordered like the doubles
+int64_t ordered_bits(double x) {
+    int64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return bits < 0 ? INT64_MIN - bits : bits;
+}
+
+uint64_t ulp_distance(double a, double b) {
+    int64_t ia = ordered_bits(a);
+    int64_t ib = ordered_bits(b);
+    return ia > ib ? (uint64_t) ia - (uint64_t) ib : (uint64_t) ib - (uint64_t) ia;
+}
+
+int report(int ok, const char *check, struct Scenario scenario, const char *detail) {
+    printf("%s %s (%s %dx%d, %d agents)%s%s\n", ok ? "PASS" : "FAIL", check, scenario.name,
+            scenario.width, scenario.height, scenario.nagents, ok ? "" : ": ", ok ? "" : detail);
+    return !ok;
+}
+
+int compare_doubles(const char *check, struct Scenario scenario, double *actual, double *expected, int n) {
+    uint64_t max_ulp = 0;
+    int worst = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t ulp = ulp_distance(actual[i], expected[i]);
+        if (ulp > max_ulp) {
+            max_ulp = ulp;
+            worst = i;
+        }
+    }
+    char detail[256];
+    snprintf(detail, sizeof(detail), "%llu ulp at %d, got %.17g expected %.17g",
+            (unsigned long long) max_ulp, worst, actual[worst], expected[worst]);
+    return report(max_ulp <= MAX_ULP, check, scenario, detail);
+}
+
+int compare_agents(const char *check, struct Scenario scenario, struct Agent *actual, struct Agent *expected, int nagents) {
+    // the agent struct is only doubles
+    return compare_doubles(check, scenario, (double *) actual, (double *) expected, nagents * sizeof(*actual) / sizeof(double));
+}
+
+int compare_bytes(const char *check, struct Scenario scenario, void *actual, void *expected, size_t size) {
+    int ok = memcmp(actual, expected, size) == 0;
+    return report(ok, check, scenario, "differs from the reference");
+}
+
+double relative_error(double actual, double expected) {
+    return expected == 0 ? fabs(actual) : fabs(actual - expected) / fabs(expected);
+}
+
+int compare_stats(const char *check, struct Scenario scenario, struct StepStats actual, struct StepStats expected) {
+    char detail[256];
+    if (relative_error(actual.trail_mass, expected.trail_mass) > MAX_STATS_ERROR) {
+        snprintf(detail, sizeof(detail), "trail mass %.17g expected %.17g", actual.trail_mass, expected.trail_mass);
+        return report(0, check, scenario, detail);
+    }
+    if (actual.coverage != expected.coverage) {
+        snprintf(detail, sizeof(detail), "coverage %ld expected %ld", actual.coverage, expected.coverage);
+        return report(0, check, scenario, detail);
+    }
+    for (int i = 0; i < TRAIL_HISTOGRAM_BINS; i++) {
+        if (actual.trail_histogram[i] != expected.trail_histogram[i]) {
+            snprintf(detail, sizeof(detail), "histogram bin %d %ld expected %ld", i, actual.trail_histogram[i], expected.trail_histogram[i]);
+            return report(0, check, scenario, detail);
+        }
+    }
+    if (fabs(actual.occupancy_entropy - expected.occupancy_entropy) > MAX_STATS_ERROR) {
+        snprintf(detail, sizeof(detail), "occupancy entropy %.17g expected %.17g", actual.occupancy_entropy, expected.occupancy_entropy);
+        return report(0, check, scenario, detail);
+    }
+    if (actual.max_cell_load != expected.max_cell_load) {
+        snprintf(detail, sizeof(detail), "max cell load %d expected %d", actual.max_cell_load, expected.max_cell_load);
+        return report(0, check, scenario, detail);
+    }
+    if (actual.live_agents != expected.live_agents) {
+        snprintf(detail, sizeof(detail), "live agents %d expected %d", actual.live_agents, expected.live_agents);
+        return report(0, check, scenario, detail);
+    }
+    return report(1, check, scenario, "");
+}
+
+// checks each kernel on its own against the reference from the same input
+int verify_kernels_exact(struct Scenario scenario) {
+    int failures = 0;
+    int width = scenario.width;
+    int height = scenario.height;
+    int ncells = width * height;
+    unsigned int seed = scenario.seed;
+    struct Behavior behavior = sample_behavior(TRAIL_MAX);
+    double *trail = random_grid(width, height, TRAIL_MAX, &seed);
+    double *food = random_food(width, height, FOOD_MAX, &seed);
+    struct Agent *agents = random_agents(scenario.nagents, width, height, &seed);
+
+    double *actual = malloc_or_die(ncells * sizeof(*actual));
+    double *expected = malloc_or_die(ncells * sizeof(*expected));
+    struct PhaseTuning tuning = default_tuning().stencil;
+    disperse_grid(trail, actual, width, height, behavior.dispersion_rate, tuning);
+    reference_disperse_grid(trail, expected, width, height, behavior.dispersion_rate);
+    failures += compare_doubles("disperse_grid", scenario, actual, expected, ncells);
+    // the tuner may pick narrow tiles and other schedules
+    tuning.tile_width = TILED_WIDTH;
+    tuning.schedule = omp_sched_dynamic;
+    tuning.chunk = 3;
+    disperse_grid(trail, actual, width, height, behavior.dispersion_rate, tuning);
+    failures += compare_doubles("tiled disperse_grid", scenario, actual, expected, ncells);
+    tuning = default_tuning().stencil;
+
+    memcpy(actual, trail, ncells * sizeof(*actual));
+    memcpy(expected, trail, ncells * sizeof(*expected));
+    struct Map actual_map = {actual, width, height, NULL};
+    struct Map expected_map = {expected, width, height, NULL};
+    evaporate_trail(actual_map, behavior.evaporation_rate_exp, behavior.evaporation_rate_lin, behavior.trail_max, tuning, NULL);
+    reference_evaporate_trail(expected_map, behavior.evaporation_rate_exp, behavior.evaporation_rate_lin);
+    failures += compare_doubles("evaporate_trail", scenario, actual, expected, ncells);
+
+    memcpy(actual, trail, ncells * sizeof(*actual));
+    memcpy(expected, trail, ncells * sizeof(*expected));
+    deposit_trail(actual_map, agents, scenario.nagents, 0, behavior.trail_deposit_rate, behavior.trail_max, tuning);
+    reference_deposit_trail(expected_map, agents, scenario.nagents, behavior.trail_deposit_rate, behavior.trail_max);
+    failures += compare_doubles("deposit_trail", scenario, actual, expected, ncells);
+
+    int *actual_freq = malloc_or_die(ncells * sizeof(*actual_freq));
+    int *expected_freq = malloc_or_die(ncells * sizeof(*expected_freq));
+    record_position(actual_freq, width, height, agents, scenario.nagents, 0, tuning, NULL);
+    reference_record_position(expected_freq, width, height, agents, scenario.nagents);
+    failures += compare_bytes("record_position", scenario, actual_freq, expected_freq, ncells * sizeof(*actual_freq));
+
+    // the same two phases again with the statistics fused in
+    struct StepStats actual_stats;
+    struct StepStats expected_stats;
+    memcpy(actual, trail, ncells * sizeof(*actual));
+    evaporate_trail(actual_map, behavior.evaporation_rate_exp, behavior.evaporation_rate_lin, behavior.trail_max, tuning, &actual_stats);
+    record_position(actual_freq, width, height, agents, scenario.nagents, 0, tuning, &actual_stats);
+    memcpy(expected, trail, ncells * sizeof(*expected));
+    reference_evaporate_trail(expected_map, behavior.evaporation_rate_exp, behavior.evaporation_rate_lin);
+    failures += compare_doubles("evaporate_trail with stats", scenario, actual, expected, ncells);
+    failures += compare_bytes("record_position with stats", scenario, actual_freq, expected_freq, ncells * sizeof(*actual_freq));
+    reference_step_stats(expected_map, expected_freq, scenario.nagents, behavior.trail_max, &expected_stats);
+    failures += compare_stats("step stats", scenario, actual_stats, expected_stats);
+
+    // on one thread move_agents draws the same random numbers as the reference
+    struct Map trail_map = {trail, width, height, NULL};
+    struct Map food_map = {food, width, height, NULL};
+    struct Agent *actual_agents = malloc_or_die(scenario.nagents * sizeof(*actual_agents));
+    memcpy(actual_agents, agents, scenario.nagents * sizeof(*actual_agents));
+    unsigned int actual_seed = scenario.seed;
+    unsigned int expected_seed = scenario.seed;
+    move_agents(trail_map, food_map, actual_agents, scenario.nagents, 0, behavior, actual_freq, &actual_seed, tuning, NULL);
+    reference_move_agents(trail_map, food_map, agents, scenario.nagents, behavior, expected_freq, &expected_seed);
+    failures += compare_agents("move_agents", scenario, actual_agents, agents, scenario.nagents);
+
+    struct ColorMap colormap = sample_colormap(COLORMAP_LENGTH);
+    struct Color *actual_image = malloc_or_die(ncells * sizeof(*actual_image));
+    color_image(actual_image, trail, food, width, height, colormap, TRAIL_MAX, FOOD_MAX, 0, tuning);
+    struct Color *expected_image = reference_color_image(trail, food, width, height, colormap, TRAIL_MAX, FOOD_MAX);
+    failures += compare_bytes("color_image", scenario, actual_image, expected_image, ncells * sizeof(*actual_image));
+    uint16_t *actual_index = malloc_or_die(ncells * sizeof(*actual_index));
+    index_image(actual_index, trail, food, width, height, colormap, TRAIL_MAX, FOOD_MAX, 0, tuning);
+    uint16_t *expected_index = reference_index_image(trail, food, width, height, colormap, TRAIL_MAX, FOOD_MAX);
+    failures += compare_bytes("index_image", scenario, actual_index, expected_index, ncells * sizeof(*actual_index));
+
+    free(actual_index);
+    free(expected_index);
+    free(actual_image);
+    free(expected_image);
+    destroy_colormap(colormap);
+    free(actual_agents);
+    free(actual_freq);
+    free(expected_freq);
+    free(actual);
+    free(expected);
+    free(agents);
+    free(food);
+    free(trail);
+    return failures;
+}
+
+// runs whole steps on one thread, which must follow the reference exactly
+int verify_steps_exact(struct Scenario scenario) {
+    struct Behavior behavior = sample_behavior(TRAIL_MAX);
+    struct RandomState actual = create_state(scenario, 1);
+    struct RandomState expected = create_state(scenario, 1);
+
+    struct StepStats stats;
+    for (int i = 0; i < EXACT_STEPS; i++) {
+        simulate_step(&actual.trail_map, actual.food_map, actual.agents, actual.nagents, 0, behavior, actual.agent_pos_freq, actual.seeds, default_tuning(), &stats);
+        reference_simulate_step(&expected.trail_map, expected.food_map, expected.agents, expected.nagents, behavior, expected.agent_pos_freq, expected.seeds);
+    }
+    int failures = compare_doubles("simulate_step trail", scenario, actual.trail_map.grid, expected.trail_map.grid, scenario.width * scenario.height);
+    failures += compare_agents("simulate_step agents", scenario, actual.agents, expected.agents, scenario.nagents);
+
+    random_state_destroy(&expected);
+    random_state_destroy(&actual);
+    return failures;
+}
+
+struct Summary {
+    double trail_mass;
+    double coverage;
+    double histogram[HISTOGRAM_BUCKETS];
+};
+
+struct Summary summarize(struct Map trail_map, struct Agent *agents, int nagents, int *freq) {
+    struct Summary summary = {0, 0, {0}};
+    int ncells = trail_map.width * trail_map.height;
+    reference_record_position(freq, trail_map.width, trail_map.height, agents, nagents);
+    for (int i = 0; i < ncells; i++) {
+        summary.trail_mass += trail_map.grid[i];
+        summary.coverage += trail_map.grid[i] > COVERAGE_THRESHOLD;
+        summary.histogram[freq[i] < HISTOGRAM_BUCKETS ? freq[i] : HISTOGRAM_BUCKETS - 1]++;
+    }
+    summary.coverage /= ncells;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        summary.histogram[i] /= ncells;
+    }
+    return summary;
+}
+
+// runs whole steps on several threads and compares aggregate statistics
+int verify_steps_statistical(struct Scenario scenario) {
+    struct Behavior behavior = sample_behavior(TRAIL_MAX);
+    struct RandomState actual = create_state(scenario, STAT_THREADS);
+    struct RandomState expected = create_state(scenario, 1);
+
+    omp_set_num_threads(STAT_THREADS);
+    for (int i = 0; i < STAT_STEPS; i++) {
+        simulate_step(&actual.trail_map, actual.food_map, actual.agents, actual.nagents, 0, behavior, actual.agent_pos_freq, actual.seeds, default_tuning(), NULL);
+        reference_simulate_step(&expected.trail_map, expected.food_map, expected.agents, expected.nagents, behavior, expected.agent_pos_freq, expected.seeds);
+    }
+    omp_set_num_threads(1);
+
+    struct Summary actual_summary = summarize(actual.trail_map, actual.agents, actual.nagents, actual.agent_pos_freq);
+    struct Summary expected_summary = summarize(expected.trail_map, expected.agents, expected.nagents, expected.agent_pos_freq);
+    char detail[256];
+    int failures = 0;
+    snprintf(detail, sizeof(detail), "got %.6g expected %.6g", actual_summary.trail_mass, expected_summary.trail_mass);
+    failures += report(relative_error(actual_summary.trail_mass, expected_summary.trail_mass) <= MAX_RELATIVE_ERROR,
+            "threaded trail mass", scenario, detail);
+    snprintf(detail, sizeof(detail), "got %.6g expected %.6g", actual_summary.coverage, expected_summary.coverage);
+    failures += report(relative_error(actual_summary.coverage, expected_summary.coverage) <= MAX_RELATIVE_ERROR,
+            "threaded coverage", scenario, detail);
+    double distance = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        distance += fabs(actual_summary.histogram[i] - expected_summary.histogram[i]) / 2;
+    }
+    snprintf(detail, sizeof(detail), "total variation distance %.6g", distance);
+    failures += report(distance <= MAX_HISTOGRAM_DISTANCE, "threaded occupancy histogram", scenario, detail);
+
+    random_state_destroy(&expected);
+    random_state_destroy(&actual);
+    return failures;
+}
+
+// copies the live agents to live and the dead ones to dead, returns the number of live agents
+int split_agents(struct Agent *agents, int nagents, struct Agent *live, struct Agent *dead) {
+    int nlive = 0;
+    for (int i = 0; i < nagents; i++) {
+        if (agents[i].energy > 0) {
+            live[nlive++] = agents[i];
+        } else {
+            dead[i - nlive] = agents[i];
+        }
+    }
+    return nlive;
+}
+
+// the kernels must skip dead agents and treat the live ones exactly like the
+// reference run on only the live agents
+int verify_dead_agents(struct Scenario scenario) {
+    int failures = 0;
+    int width = scenario.width;
+    int height = scenario.height;
+    int ncells = width * height;
+    struct Behavior behavior = sample_behavior(TRAIL_MAX);
+    struct RandomState actual = create_state(scenario, 1);
+    struct RandomState expected = create_state(scenario, 1);
+    struct Agent *agents = actual.agents;
+    for (int i = 0; i < scenario.nagents; i += DEAD_STRIDE) {
+        agents[i].energy = 0;
+    }
+    struct Agent *live = malloc_or_die(scenario.nagents * sizeof(*live));
+    struct Agent *dead = malloc_or_die(scenario.nagents * sizeof(*dead));
+    int nlive = split_agents(agents, scenario.nagents, live, dead);
+    int ndead = scenario.nagents - nlive;
+    struct Agent *actual_live = malloc_or_die(scenario.nagents * sizeof(*actual_live));
+    struct Agent *actual_dead = malloc_or_die(scenario.nagents * sizeof(*actual_dead));
+    struct PhaseTuning tuning = default_tuning().agents;
+
+    struct StepStats actual_stats;
+    struct StepStats expected_stats;
+    evaporate_trail(actual.trail_map, behavior.evaporation_rate_exp, behavior.evaporation_rate_lin, behavior.trail_max, tuning, &actual_stats);
+    record_position(actual.agent_pos_freq, width, height, agents, scenario.nagents, 1, tuning, &actual_stats);
+    reference_evaporate_trail(expected.trail_map, behavior.evaporation_rate_exp, behavior.evaporation_rate_lin);
+    reference_record_position(expected.agent_pos_freq, width, height, live, nlive);
+    reference_step_stats(expected.trail_map, expected.agent_pos_freq, nlive, behavior.trail_max, &expected_stats);
+    failures += compare_bytes("record_position with dead agents", scenario, actual.agent_pos_freq, expected.agent_pos_freq, ncells * sizeof(*actual.agent_pos_freq));
+    failures += compare_stats("step stats with dead agents", scenario, actual_stats, expected_stats);
+
+    deposit_trail(actual.trail_map, agents, scenario.nagents, 1, behavior.trail_deposit_rate, behavior.trail_max, tuning);
+    reference_deposit_trail(expected.trail_map, live, nlive, behavior.trail_deposit_rate, behavior.trail_max);
+    failures += compare_doubles("deposit_trail with dead agents", scenario, actual.trail_map.grid, expected.trail_map.grid, ncells);
+
+    move_agents(actual.trail_map, actual.food_map, agents, scenario.nagents, 1, behavior, actual.agent_pos_freq, actual.seeds, tuning, NULL);
+    reference_move_agents(expected.trail_map, expected.food_map, live, nlive, behavior, expected.agent_pos_freq, expected.seeds);
+    split_agents(agents, scenario.nagents, actual_live, actual_dead);
+    failures += compare_agents("move_agents with dead agents", scenario, actual_live, live, nlive);
+    failures += compare_bytes("dead agents stay in place", scenario, actual_dead, dead, ndead * sizeof(*dead));
+
+    for (int i = 0; i < EXACT_STEPS; i++) {
+        simulate_step(&actual.trail_map, actual.food_map, agents, scenario.nagents, 1, behavior, actual.agent_pos_freq, actual.seeds, default_tuning(), NULL);
+        reference_simulate_step(&expected.trail_map, expected.food_map, live, nlive, behavior, expected.agent_pos_freq, expected.seeds);
+    }
+    split_agents(agents, scenario.nagents, actual_live, actual_dead);
+    failures += compare_doubles("simulate_step trail with dead agents", scenario, actual.trail_map.grid, expected.trail_map.grid, ncells);
+    failures += compare_agents("simulate_step agents with dead agents", scenario, actual_live, live, nlive);
+
+    free(actual_dead);
+    free(actual_live);
+    free(dead);
+    free(live);
+    random_state_destroy(&expected);
+    random_state_destroy(&actual);
+    return failures;
+}
+
+// on one thread update_population draws the same random numbers as the reference
+int verify_update_population(struct Scenario scenario) {
+    int width = scenario.width;
+    int height = scenario.height;
+    unsigned int seed = scenario.seed;
+    struct Map food = {random_food(width, height, FOOD_MAX, &seed), width, height, NULL};
+    struct Agent *agents = random_agents(scenario.nagents, width, height, &seed);
+    // some agents start dead and some have enough energy to split
+    for (int i = 0; i < scenario.nagents; i++) {
+        agents[i].energy = randd(-0.5, 3, &seed);
+    }
+    int *freq = malloc_or_die(width * height * sizeof(*freq));
+    reference_record_position(freq, width, height, agents, scenario.nagents);
+    struct PopulationBehavior behavior = {0.5, 0.05, 2, 1, 0.5};
+
+    struct Arena arena = arena_create(agent_pool_size(scenario.nagents, 1, 1));
+    struct AgentPool pool = agent_pool_create(&arena, scenario.nagents, 1, 1);
+    memcpy(pool.agents, agents, scenario.nagents * sizeof(*agents));
+    pool.count = scenario.nagents;
+    // a small spawn buffer so some splits are dropped
+    pool.spawn_capacity = scenario.nagents / 8 + 1;
+    struct Agent *expected_spawns = malloc_or_die(pool.spawn_capacity * sizeof(*expected_spawns));
+    int nexpected_spawns = 0;
+
+    unsigned int actual_seed = scenario.seed;
+    unsigned int expected_seed = scenario.seed;
+    update_population(&pool, food, FOOD_MAX, freq, behavior, &actual_seed, 0, default_tuning().agents);
+    reference_update_population(agents, scenario.nagents, food, FOOD_MAX, freq, behavior, &expected_seed, expected_spawns, &nexpected_spawns, pool.spawn_capacity);
+    int failures = compare_agents("update_population agents", scenario, pool.agents, agents, scenario.nagents);
+    if (pool.spawn_counts[0] != nexpected_spawns) {
+        char detail[256];
+        snprintf(detail, sizeof(detail), "%d spawns, expected %d", pool.spawn_counts[0], nexpected_spawns);
+        failures += report(0, "update_population spawns", scenario, detail);
+    } else {
+        failures += compare_bytes("update_population spawns", scenario, pool.spawns, expected_spawns, nexpected_spawns * sizeof(*expected_spawns));
+    }
+
+    free(expected_spawns);
+    arena_destroy(&arena);
+    free(freq);
+    free(agents);
+    free(food.grid);
+    return failures;
+}
+
+// with the same team size and schedule, every agent draws from the same seed
+// in both step structures, so the single region must match the split one
+int verify_single_region(struct Scenario scenario) {
+    struct Behavior behavior = sample_behavior(TRAIL_MAX);
+    struct RandomState actual = create_state(scenario, STAT_THREADS);
+    struct RandomState expected = create_state(scenario, STAT_THREADS);
+
+    struct StepStats actual_stats;
+    struct StepStats expected_stats;
+    omp_set_num_threads(STAT_THREADS);
+    for (int i = 0; i < STAT_STEPS; i++) {
+        simulate_step(&actual.trail_map, actual.food_map, actual.agents, actual.nagents, 0, behavior, actual.agent_pos_freq, actual.seeds, default_tuning(), &actual_stats);
+        simulate_step_split(&expected.trail_map, expected.food_map, expected.agents, expected.nagents, 0, behavior, expected.agent_pos_freq, expected.seeds, default_tuning(), &expected_stats);
+    }
+    omp_set_num_threads(1);
+    int ncells = scenario.width * scenario.height;
+    int failures = compare_doubles("single region trail", scenario, actual.trail_map.grid, expected.trail_map.grid, ncells);
+    failures += compare_agents("single region agents", scenario, actual.agents, expected.agents, scenario.nagents);
+    failures += compare_bytes("single region positions", scenario, actual.agent_pos_freq, expected.agent_pos_freq, ncells * sizeof(*actual.agent_pos_freq));
+    failures += compare_stats("single region stats", scenario, actual_stats, expected_stats);
+
+    random_state_destroy(&expected);
+    random_state_destroy(&actual);
+    return failures;
+}
+
+// with the same team size and schedule, the population update draws from the
+// same seeds and compaction keeps the same order in both iteration structures,
+// so the single region must match the split one
+int verify_single_region_iteration(struct Scenario scenario) {
+    struct IterationSettings settings;
+    settings.behavior = sample_behavior(TRAIL_MAX);
+    settings.population = (struct PopulationBehavior) {0.5, 0.05, 2, 1, 0.5};
+    settings.dynamic = 1;
+    settings.colormap = sample_colormap(COLORMAP_LENGTH);
+    settings.food_maxval = FOOD_MAX;
+    settings.indexed = 1;
+    struct RandomState actual = create_state(scenario, STAT_THREADS);
+    struct RandomState expected = create_state(scenario, STAT_THREADS);
+    int ncells = scenario.width * scenario.height;
+    int capacity = ITERATION_CAPACITY_FACTOR * scenario.nagents;
+    size_t pool_size = agent_pool_size(capacity, STAT_THREADS, 1);
+    struct Arena arena = arena_create(2 * pool_size);
+    struct AgentPool actual_pool = agent_pool_create(&arena, capacity, STAT_THREADS, 1);
+    struct AgentPool expected_pool = agent_pool_create(&arena, capacity, STAT_THREADS, 1);
+    memcpy(actual_pool.agents, actual.agents, scenario.nagents * sizeof(*actual.agents));
+    memcpy(expected_pool.agents, expected.agents, scenario.nagents * sizeof(*expected.agents));
+    actual_pool.count = scenario.nagents;
+    expected_pool.count = scenario.nagents;
+    uint16_t *actual_frame = malloc_or_die(ncells * sizeof(*actual_frame));
+    uint16_t *expected_frame = malloc_or_die(ncells * sizeof(*expected_frame));
+
+    struct StepStats actual_stats;
+    struct StepStats expected_stats;
+    struct Tuning tuning = default_tuning();
+    tuning.step_threads = STAT_THREADS;
+    omp_set_num_threads(STAT_THREADS);
+    for (int i = 0; i < STAT_STEPS; i++) {
+        int compact = (i + 1) % ITERATION_COMPACTION_PERIOD == 0;
+        simulate_iteration(&actual.trail_map, actual.food_map, &actual_pool, actual.agent_pos_freq, actual.seeds, settings, compact, actual_frame, tuning, &actual_stats);
+        simulate_iteration_split(&expected.trail_map, expected.food_map, &expected_pool, expected.agent_pos_freq, expected.seeds, settings, compact, expected_frame, tuning, &expected_stats);
+    }
+    omp_set_num_threads(1);
+    int failures = compare_doubles("single region iteration trail", scenario, actual.trail_map.grid, expected.trail_map.grid, ncells);
+    if (actual_pool.count != expected_pool.count) {
+        char detail[256];
+        snprintf(detail, sizeof(detail), "%d agents, expected %d", actual_pool.count, expected_pool.count);
+        failures += report(0, "single region iteration agents", scenario, detail);
+    } else {
+        failures += compare_agents("single region iteration agents", scenario, actual_pool.agents, expected_pool.agents, actual_pool.count);
+    }
+    failures += compare_bytes("single region iteration frame", scenario, actual_frame, expected_frame, ncells * sizeof(*actual_frame));
+    failures += compare_stats("single region iteration stats", scenario, actual_stats, expected_stats);
+
+    free(expected_frame);
+    free(actual_frame);
+    arena_destroy(&arena);
+    random_state_destroy(&expected);
+    random_state_destroy(&actual);
+    destroy_colormap(settings.colormap);
+    return failures;
+}
+
+// kills some agents, fills the spawn buffers past the free space and checks
+// the compacted pool is the live agents in order followed by the spawns that fit
+int verify_compaction(struct Scenario scenario) {
+    unsigned int seed = scenario.seed;
+    int capacity = scenario.nagents;
+    struct Arena arena = arena_create(agent_pool_size(capacity, STAT_THREADS, 1));
+    struct AgentPool pool = agent_pool_create(&arena, capacity, STAT_THREADS, 1);
+    struct Agent *initial = random_agents(scenario.nagents, scenario.width, scenario.height, &seed);
+    memcpy(pool.agents, initial, scenario.nagents * sizeof(*initial));
+    pool.count = scenario.nagents;
+    for (int i = 0; i < pool.count; i++) {
+        if (randint(0, 2, &seed) == 0) {
+            pool.agents[i].energy = 0;
+        }
+    }
+    for (int i = 0; i < STAT_THREADS; i++) {
+        pool.spawn_counts[i] = randint(0, pool.spawn_capacity, &seed);
+        for (int j = 0; j < pool.spawn_counts[i]; j++) {
+            pool.spawns[i * pool.spawn_capacity + j] = initial[randint(0, scenario.nagents - 1, &seed)];
+        }
+    }
+
+    struct Agent *expected = malloc_or_die(capacity * sizeof(*expected));
+    int nexpected = 0;
+    for (int i = 0; i < pool.count; i++) {
+        if (pool.agents[i].energy > 0) {
+            expected[nexpected++] = pool.agents[i];
+        }
+    }
+    for (int i = 0; i < STAT_THREADS; i++) {
+        for (int j = 0; j < pool.spawn_counts[i] && nexpected < capacity; j++) {
+            expected[nexpected++] = pool.spawns[i * pool.spawn_capacity + j];
+        }
+    }
+
+    omp_set_num_threads(STAT_THREADS);
+    compact_agents(&pool, 0);
+    omp_set_num_threads(1);
+    int failures;
+    if (pool.count != nexpected) {
+        char detail[256];
+        snprintf(detail, sizeof(detail), "%d agents, expected %d", pool.count, nexpected);
+        failures = report(0, "compact_agents", scenario, detail);
+    } else {
+        failures = compare_bytes("compact_agents", scenario, pool.agents, expected, nexpected * sizeof(*expected));
+    }
+
+    free(expected);
+    free(initial);
+    arena_destroy(&arena);
+    return failures;
+}
+
+int verify_kernels(void) {
+    int max_threads = omp_get_max_threads();
+    int failures = 0;
+    int nscenarios = sizeof(scenarios) / sizeof(*scenarios);
+    // exact checks rely on the order of the random numbers, so use one thread
+    omp_set_num_threads(1);
+    for (int i = 0; i < nscenarios; i++) {
+        failures += verify_kernels_exact(scenarios[i]);
+        failures += verify_steps_exact(scenarios[i]);
+        failures += verify_single_region(scenarios[i]);
+        failures += verify_single_region_iteration(scenarios[i]);
+        failures += verify_dead_agents(scenarios[i]);
+        failures += verify_update_population(scenarios[i]);
+    }
+    for (int i = 0; i < nscenarios; i++) {
+        // too few agents for the statistics to be stable
+        if (scenarios[i].nagents < 1000) {
+            continue;
+        }
+        failures += verify_steps_statistical(scenarios[i]);
+        failures += verify_compaction(scenarios[i]);
+    }
+    omp_set_num_threads(max_threads);
+    printf("%d check%s failed\n", failures, failures == 1 ? "" : "s");
+    return failures;
+}
+
+int main(void) {
+    return verify_kernels() == 0 ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+/** @file
+ * @brief Checks the optimized kernels against the reference simulation.
+ *
+ * Every scenario uses fixed seeds so failures are reproducible. Grid kernels
+ * must match the reference within a few ulp. Agent kernels must match exactly
+ * when run on one thread, and on several threads, where the random numbers
+ * are drawn in a different order, the trail mass, coverage and occupancy
+ * histogram must stay close to the reference. The single region step must
+ * match the step with a region per phase on several threads.
+ */
+
+/**
+ * Runs every check and prints a line for each.
+ * @return The number of failed checks
+ */
+int verify_kernels(void);
+
+#endif